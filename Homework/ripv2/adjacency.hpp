@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+
+#include "format/common.hpp"
+
+
+namespace ripv2 {
+
+namespace adjacency {
+
+using namespace format;
+
+constexpr uint32_t kNoAdjacency = -1;
+constexpr size_t kMaxAdjacencyNum = 4096;
+
+struct Adjacency {
+  uint32_t interface_index;
+  Ipv4Address address;
+  std::atomic<uint64_t> link;
+    // ^ The MAC address in the low 48 bits, plus `kResolved`, so that a
+    //   reader never sees half of an ARP answer.
+};
+
+// Every neighbor the router sends to, with the MAC address ARP gave for it,
+// so a packet to a resolved neighbor is sent without any ARP table lookup.
+// Indexes are stable and are what the FIB stores per route. The address
+// 0.0.0.0 marks the glean adjacency of a directly connected route; packets
+// through it go to their own destination, which the forwarding path
+// resolves itself rather than adding a host adjacency here.
+//
+// Only the control plane adds, releases and resolves adjacencies, while the
+// forwarding path reads them through a FIB snapshot: the storage is
+// allocated once and never moves, an adjacency is complete before a
+// published FIB refers to it, its MAC address is replaced atomically, and
+// it is released only once no FIB a reader can hold refers to it (see
+// `fib::Publisher::reclaim`).
+struct AdjacencyTable {
+
+  static constexpr uint64_t kResolved = static_cast<uint64_t>(1) << 48;
+
+  std::vector<Adjacency> adjacencies_
+    = std::vector<Adjacency>(kMaxAdjacencyNum);
+  size_t size_ = 0;
+  std::vector<uint32_t> free_adjacencies_;
+  size_t refused_ = 0;
+    // ^ Interns refused for lack of room, for the control plane to report.
+  std::vector<uint32_t> slots_
+    = std::vector<uint32_t>(2 * kMaxAdjacencyNum, kNoAdjacency);
+
+  size_t size() const {
+    return size_;
+  }
+
+  size_t home_of(uint32_t interface_index, Ipv4Address address) const {
+    uint64_t key = static_cast<uint64_t>(interface_index) << 32
+      | address.data_;
+    return (key * 0x9e3779b97f4a7c15) >> (64 - quick_log2(slots_.size()));
+  }
+
+  size_t locate(uint32_t interface_index, Ipv4Address address) const {
+    size_t mask = slots_.size() - 1;
+    size_t i = home_of(interface_index, address);
+    while (slots_[i] != kNoAdjacency) {
+      const auto &a = adjacencies_[slots_[i]];
+      if (a.interface_index == interface_index && a.address == address) {
+        break;
+      }
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  uint32_t find(uint32_t interface_index, Ipv4Address address) const {
+    return slots_[locate(interface_index, address)];
+  }
+
+  bool is_free(uint32_t id) const {
+    return adjacencies_[id].interface_index == kNoAdjacency;
+  }
+
+  // Returns `kNoAdjacency` while `kMaxAdjacencyNum` adjacencies are in use.
+  uint32_t intern(uint32_t interface_index, Ipv4Address address) {
+    size_t i = locate(interface_index, address);
+    if (slots_[i] != kNoAdjacency) {
+      return slots_[i];
+    }
+    uint32_t id;
+    if (!free_adjacencies_.empty()) {
+      id = free_adjacencies_.back();
+      free_adjacencies_.pop_back();
+    } else if (size_ < kMaxAdjacencyNum) {
+      id = size_++;
+    } else {
+      ++refused_;
+      return kNoAdjacency;
+    }
+    auto &a = adjacencies_[id];
+    a.interface_index = interface_index;
+    a.address = address;
+    a.link.store(0);
+    slots_[i] = id;
+    return id;
+  }
+
+  // Frees adjacency `id` for reuse, closing the gap it leaves in its probe
+  // run as `RoutingTable::remove` does.
+  void release(uint32_t id) {
+    auto &a = adjacencies_[id];
+    size_t mask = slots_.size() - 1;
+    size_t hole = locate(a.interface_index, a.address);
+    for (size_t i=(hole+1)&mask; slots_[i]!=kNoAdjacency; i=(i+1)&mask) {
+      const auto &b = adjacencies_[slots_[i]];
+      size_t home = home_of(b.interface_index, b.address);
+      if (((i - home) & mask) >= ((i - hole) & mask)) {
+        slots_[hole] = slots_[i];
+        hole = i;
+      }
+    }
+    slots_[hole] = kNoAdjacency;
+    a.interface_index = kNoAdjacency;
+    free_adjacencies_.push_back(id);
+  }
+
+  // Whether adjacency `id` is resolved, and to which MAC address.
+  bool read_link(uint32_t id, MacAddress &mac_address) const {
+    uint64_t link = adjacencies_[id].link.load(std::memory_order_acquire);
+    for (size_t i=0; i<mac_address.data_.size(); ++i) {
+      mac_address.data_[i] = link >> (8 * i);
+    }
+    return link & kResolved;
+  }
+
+  // Records the outcome of an ARP query for adjacency `id`; returns whether
+  // anything changed.
+  bool update(uint32_t id, bool resolved, const MacAddress &mac_address) {
+    uint64_t link = 0;
+    if (resolved) {
+      link = kResolved;
+      for (size_t i=0; i<mac_address.data_.size(); ++i) {
+        link |= static_cast<uint64_t>(mac_address.data_[i]) << (8 * i);
+      }
+    }
+    return adjacencies_[id].link.exchange(link,
+      std::memory_order_acq_rel) != link;
+  }
+};
+}
+}
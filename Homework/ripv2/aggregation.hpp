@@ -0,0 +1,174 @@
+#pragma once
+
+#include <iterator>
+#include <random>
+
+#include "common.hpp"
+
+
+namespace ripv2 {
+
+namespace aggregation {
+
+constexpr uint32_t kNoRoute = -1;
+
+struct Route {
+  uint32_t address;
+  uint32_t length;
+  uint32_t value;
+};
+
+// Binary trie over routes, used both to compress a route set and as a
+// reference longest prefix matcher when verifying the result.
+struct Trie {
+
+  static constexpr uint32_t kNoChild = 0;
+
+  struct Node {
+    std::array<uint32_t, 2> children;
+    bool has_route;
+    uint32_t value;
+    std::vector<uint32_t> candidates;
+  };
+
+  std::vector<Node> nodes_ = { { {kNoChild, kNoChild}, false, kNoRoute, {} } };
+
+  static uint32_t bit_at(uint32_t address, uint32_t depth) {
+    return (address >> (31 - depth)) % 2;
+  }
+
+  uint32_t add_child(uint32_t node, uint32_t bit, uint32_t value) {
+    nodes_.push_back({ {kNoChild, kNoChild}, false, value, {} });
+    nodes_[node].children[bit] = nodes_.size() - 1;
+    return nodes_.size() - 1;
+  }
+
+  void insert(const Route &route) {
+    uint32_t node = 0;
+    for (uint32_t depth=0; depth<route.length; ++depth) {
+      uint32_t bit = bit_at(route.address, depth);
+      uint32_t child = nodes_[node].children[bit];
+      node = child != kNoChild ? child : add_child(node, bit, kNoRoute);
+    }
+    nodes_[node].has_route = true;
+    nodes_[node].value = route.value;
+  }
+
+  uint32_t lookup(uint32_t address) const {
+    uint32_t node = 0, value = nodes_[0].value;
+    for (uint32_t depth=0; depth<32; ++depth) {
+      node = nodes_[node].children[bit_at(address, depth)];
+      if (node == kNoChild) {
+        break;
+      }
+      if (nodes_[node].has_route) {
+        value = nodes_[node].value;
+      }
+    }
+    return value;
+  }
+
+  // ORTC pass 1: give every node zero or two children, pushing inherited
+  // values down to the leaves.
+  void normalize(uint32_t node, uint32_t inherited) {
+    if (nodes_[node].has_route) {
+      inherited = nodes_[node].value;
+    }
+    auto children = nodes_[node].children;
+    if (children[0] == kNoChild && children[1] == kNoChild) {
+      nodes_[node].value = inherited;
+      return;
+    }
+    for (uint32_t bit=0; bit<2; ++bit) {
+      if (children[bit] == kNoChild) {
+        add_child(node, bit, inherited);
+      } else {
+        normalize(children[bit], inherited);
+      }
+    }
+  }
+
+  // ORTC pass 2: each node's candidate next hops are the intersection of
+  // its children's, or their union when that is empty.
+  void collect_candidates(uint32_t node) {
+    auto &n = nodes_[node];
+    if (n.children[0] == kNoChild) {
+      n.candidates = { n.value };
+      return;
+    }
+    collect_candidates(n.children[0]);
+    collect_candidates(n.children[1]);
+    const auto &a = nodes_[nodes_[node].children[0]].candidates;
+    const auto &b = nodes_[nodes_[node].children[1]].candidates;
+    std::vector<uint32_t> merged;
+    std::set_intersection(a.cbegin(), a.cend(),
+      b.cbegin(), b.cend(), std::back_inserter(merged));
+    if (merged.empty()) {
+      std::set_union(a.cbegin(), a.cend(),
+        b.cbegin(), b.cend(), std::back_inserter(merged));
+    }
+    nodes_[node].candidates = std::move(merged);
+  }
+
+  // ORTC pass 3: a node needs a route only when what it inherits is not
+  // among its candidates.
+  void emit(uint32_t node, uint32_t address, uint32_t depth,
+      uint32_t inherited, std::vector<Route> &routes) const {
+    const auto &n = nodes_[node];
+    if (!std::binary_search(n.candidates.cbegin(),
+        n.candidates.cend(), inherited)) {
+      inherited = n.candidates.front();
+      routes.push_back({address, depth, inherited});
+    }
+    if (n.children[0] != kNoChild) {
+      uint32_t right = address | static_cast<uint32_t>(1) << (31 - depth);
+      emit(n.children[0], address, depth + 1, inherited, routes);
+      emit(n.children[1], right, depth + 1, inherited, routes);
+    }
+  }
+};
+
+// Computes the smallest route set forwarding every address exactly like
+// `routes` (Optimal Routing Table Constructor). The result may contain
+// routes with value `kNoRoute`, which must be installed as discard routes.
+inline std::vector<Route> compress(const std::vector<Route> &routes) {
+  Trie trie;
+  for (const auto &route : routes) {
+    trie.insert(route);
+  }
+  trie.normalize(0, kNoRoute);
+  trie.collect_candidates(0);
+  std::vector<Route> compressed;
+  trie.emit(0, 0, 0, kNoRoute, compressed);
+  return compressed;
+}
+
+// Checks on `samples` addresses that both route sets resolve to the same
+// value; half of the addresses are drawn from inside `original` routes so
+// that sparse tables are exercised too.
+inline bool verify_equivalence(const std::vector<Route> &original,
+    const std::vector<Route> &compressed, size_t samples, uint32_t seed) {
+  Trie a, b;
+  for (const auto &route : original) {
+    a.insert(route);
+  }
+  for (const auto &route : compressed) {
+    b.insert(route);
+  }
+  std::mt19937 random(seed);
+  for (size_t i=0; i<samples; ++i) {
+    uint32_t address = random();
+    if (i % 2 == 0 && !original.empty()) {
+      const auto &route = original[random() % original.size()];
+      uint32_t host_mask = route.length == 0 ? -1
+        : (static_cast<uint32_t>(1) << (32 - route.length)) - 1;
+      address = route.address | (address & host_mask);
+    }
+    if (a.lookup(address) != b.lookup(address)) {
+      return false;
+    }
+  }
+  return true;
+}
+}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "damping.hpp"
+#include "table.hpp"
+#include "timer.hpp"
+
+
+namespace ripv2 {
+
+namespace aging {
+
+using namespace format;
+
+// RFC 2453 route lifetime: a learned route is dropped to metric 16 when it
+// has not been refreshed for `kTimeout`, and deleted `kGarbageCollection`
+// later. Each route keeps one timer on the wheel, switched between the two
+// phases, and found again by its prefix when it fires. A timeout counts as a
+// withdrawal for flap damping: a neighbor that flaps by going silent is
+// damped like one that withdraws its routes.
+struct RouteAger {
+
+  static constexpr uint64_t kTimeout = 180000;
+  static constexpr uint64_t kGarbageCollection = 120000;
+  static constexpr uint64_t kTickLength = 100;
+
+  table::RoutingTable *table_;
+  damping::FlapDamper *damper_;
+  timer::TimingWheel wheel_{kTickLength};
+
+  static uint64_t key_of(table::Ipv4Prefix prefix) {
+    return static_cast<uint64_t>(prefix.address_.data_) << 32
+      | prefix.mask_length();
+  }
+
+  // Sets the clock to `now` before any route is aged; see
+  // `TimingWheel::start`.
+  void start(uint64_t now) {
+    wheel_.start(now);
+  }
+
+  static table::Ipv4Prefix prefix_of(uint64_t key) {
+    return table::Ipv4Prefix::from_address_and_mask_length(
+      { static_cast<uint32_t>(key >> 32) }, key % 64);
+  }
+
+  // (Re)starts the timeout of a route that was just learned or refreshed.
+  void refresh(table::Ipv4Prefix prefix, uint64_t now) {
+    table_->stale_[table_->index_of(prefix)] = false;
+    arm(prefix, now, kTimeout);
+  }
+
+  // Starts the garbage collection of a route that was just withdrawn, i.e.
+  // set to metric 16.
+  void withdraw(table::Ipv4Prefix prefix, uint64_t now) {
+    arm(prefix, now, kGarbageCollection);
+  }
+
+  void arm(table::Ipv4Prefix prefix, uint64_t now, uint64_t delay) {
+    uint32_t &timer = table_->timers_[table_->index_of(prefix)];
+    if (timer == timer::kNoTimer) {
+      timer = wheel_.schedule(now, delay, key_of(prefix));
+    } else {
+      wheel_.reschedule(timer, now, delay);
+    }
+  }
+
+  // Appends the routes that timed out to `changed`, and the prefixes of
+  // routes deleted when their garbage collection ends to `removed`; those
+  // were already withdrawn, so they need no triggered update.
+  void advance(uint64_t now,
+      std::vector<table::RoutingTable::Entry> &changed,
+      std::vector<table::Ipv4Prefix> &removed) {
+    wheel_.advance(now, [&](uint32_t id) {
+      auto prefix = prefix_of(wheel_.payload_of(id));
+      uint32_t index = table_->index_of(prefix);
+      if (table_->metrics_[index] < table::kInfinityMetric) {
+        damper_->withdraw(table_->entry(index), now);
+        table_->metrics_[index] = table::kInfinityMetric;
+        changed.push_back(table_->entry(index));
+        wheel_.reschedule(id, now, kGarbageCollection);
+      } else {
+        wheel_.release(id);
+        table_->remove(prefix);
+        removed.push_back(prefix);
+      }
+    });
+  }
+};
+}
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "table.hpp"
+
+
+namespace ripv2 {
+
+namespace checkpoint {
+
+using namespace format;
+
+// On-disk layout: a `Header` followed by `route_num` fixed-size `Record`s,
+// in host byte order, so that a mapped file can be read in place. A file
+// written with the other byte order fails the magic check.
+constexpr uint32_t kMagic = 0x32504952;  // "RIP2" read little-endian
+constexpr uint32_t kVersion = 1;
+
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t route_num;
+};
+
+struct Record {
+  uint32_t address;
+  uint32_t next_hop;
+  uint32_t interface_index;
+  uint8_t length;
+  uint8_t metric;
+  uint16_t reserved;
+};
+
+static_assert(sizeof(Header) == 16 && sizeof(Record) == 16, "");
+
+// The learned, reachable routes of `table`, as they are saved.
+inline void collect(const table::RoutingTable &table,
+    std::vector<Record> &records) {
+  records.clear();
+  for (uint32_t i=0; i<table.size(); ++i) {
+    const auto &next_hop = table.next_hops_[table.next_hop_ids_[i]];
+    if (next_hop.address.data_ == 0
+        || table.metrics_[i] >= table::kInfinityMetric) {
+      continue;
+        // ^ Directly connected routes are regenerated from the environment.
+    }
+    records.push_back({ table.addresses_[i], next_hop.address.data_,
+      next_hop.interface_index, table.lengths_[i], table.metrics_[i], 0 });
+  }
+}
+
+// The file is written under a temporary name and renamed over `path`, so a
+// crash never leaves a torn checkpoint behind.
+inline bool write(const std::vector<Record> &records, const char *path) {
+  Header header{ kMagic, kVersion, sizeof(Record),
+    static_cast<uint32_t>(records.size()) };
+  std::string temporary = std::string(path) + ".tmp";
+  std::FILE *file = std::fopen(temporary.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+    && std::fwrite(records.data(), sizeof(Record),
+      records.size(), file) == records.size()
+    && std::fflush(file) == 0 && ::fsync(::fileno(file)) == 0;
+  ok &= std::fclose(file) == 0;
+  return ok && std::rename(temporary.c_str(), path) == 0;
+}
+
+// Saves checkpoints on a background thread, so that writing and syncing
+// the file never stalls the forwarding loop. Only collecting the routes
+// happens on the caller's thread; a save is skipped when they are the same
+// as last saved, or while the previous save is still being written.
+struct Writer {
+
+  const char *path_;
+  std::vector<Record> collected_;
+  std::vector<Record> saved_;
+    // ^ Owned by the background thread while `busy_` is set.
+  bool is_saved_ = false;
+  std::atomic<bool> busy_{false};
+  std::atomic<bool> failed_{false};
+  std::thread thread_;
+
+  explicit Writer(const char *path) : path_(path) {}
+
+  Writer(const Writer&) = delete;
+  Writer &operator=(const Writer&) = delete;
+
+  ~Writer() {
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  // Returns false when the previous save turned out to have failed; it is
+  // retried with this one.
+  bool save(const table::RoutingTable &table) {
+    if (busy_.load()) {
+      return true;
+    }
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    bool ok = !failed_.exchange(false);
+    is_saved_ &= ok;
+    collect(table, collected_);
+    if (is_saved_ && collected_.size() == saved_.size()
+        && std::memcmp(collected_.data(), saved_.data(),
+          saved_.size() * sizeof(Record)) == 0) {
+      return ok;
+    }
+    std::swap(collected_, saved_);
+    is_saved_ = true;
+    busy_.store(true);
+    thread_ = std::thread([this] {
+      failed_.store(!write(saved_, path_));
+      busy_.store(false);
+    });
+    return ok;
+  }
+};
+
+// Maps the checkpoint at `path` once and appends its routes to `entries`.
+// Returns false, leaving `entries` untouched, when the file is missing or
+// does not match this layout.
+inline bool load(const char *path,
+    std::vector<table::RoutingTable::Entry> &entries) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat status;
+  if (::fstat(fd, &status) != 0
+      || static_cast<size_t>(status.st_size) < sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+  size_t size = status.st_size;
+  void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  const auto *header = static_cast<const Header*>(mapping);
+  bool ok = header->magic == kMagic && header->version == kVersion
+    && header->record_size == sizeof(Record)
+    && size == sizeof(Header) + header->route_num * sizeof(Record);
+  if (ok) {
+    const auto *records = reinterpret_cast<const Record*>(header + 1);
+    for (uint32_t i=0; i<header->route_num; ++i) {
+      const auto &record = records[i];
+      if (record.length > 32 || record.metric == 0
+          || record.metric >= table::kInfinityMetric) {
+        continue;
+      }
+      entries.push_back({
+        table::Ipv4Prefix::from_address_and_mask_length(
+          { record.address }, record.length),
+        record.metric, record.interface_index, { record.next_hop } });
+    }
+  }
+  ::munmap(mapping, size);
+  return ok;
+}
+}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cmath>
+#include <unordered_map>
+
+#include "table.hpp"
+
+
+namespace ripv2 {
+
+namespace damping {
+
+using namespace format;
+
+// Route flap damping after RFC 2439, adapted to RIP, where a flap is a
+// route being withdrawn, or timing out, and then coming back; plain metric
+// changes are how distance vectors converge and are not charged. As in RFC
+// 2439, penalties are kept per route and peer, i.e. per prefix, interface
+// and next hop: a neighbor that flaps does not hold down the paths other
+// neighbors offer for the same prefix. Each withdrawal adds to the penalty
+// of its route, which decays exponentially with `kHalfLife`. Once the
+// penalty exceeds `kSuppressThreshold` the route is held down: its
+// re-advertisements are ignored until the penalty decays below
+// `kReuseThreshold`, so that it stays unreachable instead of flapping.
+struct FlapDamper {
+
+  static constexpr double kWithdrawalPenalty = 1000;
+  static constexpr double kSuppressThreshold = 2000;
+  static constexpr double kReuseThreshold = 750;
+  static constexpr double kMaxPenalty = 12000;
+    // ^ Bounds a hold-down to 4 half-lives.
+  static constexpr double kForgetThreshold = 1;
+  static constexpr uint64_t kHalfLife = 60000;
+
+  struct State {
+    double penalty;
+    uint64_t updated_at;
+    bool suppressed;
+    uint32_t suppression_num;
+      // ^ Times the route was held down.
+    uint32_t ignored_num;
+      // ^ Re-advertisements ignored while it was.
+  };
+
+  struct Key {
+    uint64_t prefix;
+      // ^ In the `aging::RouteAger::key_of` form.
+    uint64_t next_hop;
+      // ^ The interface index in the high half.
+
+    bool operator==(const Key &other) const {
+      return prefix == other.prefix && next_hop == other.next_hop;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const {
+      return (key.prefix ^ key.next_hop * 0x9e3779b97f4a7c15)
+        * 0xbf58476d1ce4e5b9 >> 16;
+    }
+  };
+
+  std::unordered_map<Key, State, KeyHash> states_;
+
+  static Key key_of(const table::RoutingTable::Entry &route) {
+    return {
+      static_cast<uint64_t>(route.prefix.address_.data_) << 32
+        | route.prefix.mask_length(),
+      static_cast<uint64_t>(route.interface_index) << 32
+        | route.next_hop.data_,
+    };
+  }
+
+  // Brings the penalty of `state` forward to `now`.
+  static void decay(State &state, uint64_t now) {
+    state.penalty *= std::exp2(-static_cast<double>(now - state.updated_at)
+      / kHalfLife);
+    state.updated_at = now;
+    if (state.suppressed && state.penalty < kReuseThreshold) {
+      state.suppressed = false;
+    }
+  }
+
+  void withdraw(const table::RoutingTable::Entry &route, uint64_t now) {
+    auto &state = states_.emplace(key_of(route),
+      State{0, now, false, 0, 0}).first->second;
+    decay(state, now);
+    state.penalty += kWithdrawalPenalty;
+    if (state.penalty > kMaxPenalty) {
+      state.penalty = kMaxPenalty;
+    }
+    if (!state.suppressed && state.penalty > kSuppressThreshold) {
+      state.suppressed = true;
+      ++state.suppression_num;
+    }
+  }
+
+  // Returns whether `route`, as offered by its next hop, may make an
+  // unreachable or unknown prefix reachable now. Routes never withdrawn are
+  // not tracked at all.
+  bool readvertise(const table::RoutingTable::Entry &route, uint64_t now) {
+    auto it = states_.find(key_of(route));
+    if (it == states_.end()) {
+      return true;
+    }
+    auto &state = it->second;
+    decay(state, now);
+    if (state.suppressed) {
+      ++state.ignored_num;
+    }
+    return !state.suppressed;
+  }
+
+  double penalty_of(const table::RoutingTable::Entry &route,
+      uint64_t now) const {
+    auto it = states_.find(key_of(route));
+    if (it == states_.end()) {
+      return 0;
+    }
+    State state = it->second;
+    decay(state, now);
+    return state.penalty;
+  }
+
+  // Drops the routes, with their counts, whose penalty has decayed to
+  // nothing.
+  void forget(uint64_t now) {
+    for (auto it=states_.begin(); it!=states_.end(); ) {
+      decay(it->second, now);
+      if (it->second.penalty < kForgetThreshold) {
+        it = states_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+};
+}
+}
@@ -11,7 +11,10 @@
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
 
+#include "damping.hpp"
+#include "flow_cache.hpp"
 #include "table.hpp"
+#include "triggering.hpp"
 
 
 #define DEFINE_PARSE constexpr auto parse( \
@@ -82,11 +85,39 @@ namespace debug {
 
   inline void print_routing_table_to_stderr(const table::RoutingTable &table) {
     SPDLOG_INFO("-----BEGIN ROUTING TABLE-----");
-    for (auto e : table.entries_) {
-      SPDLOG_INFO("{};", e);
+    for (uint32_t i=0; i<table.size(); ++i) {
+      SPDLOG_INFO("{};", table.entry(i));
     }
     SPDLOG_INFO("-----END ROUTING TABLE-----");
   }
+
+  inline void print_flow_cache_stats_to_stderr(
+      const flow_cache::DestinationCache &cache) {
+    SPDLOG_INFO("Flow cache: {} hits, {} misses", cache.hits_, cache.misses_);
+  }
+
+  // Penalties are as of the last update of each route, or `forget`.
+  inline void print_damping_stats_to_stderr(
+      const damping::FlapDamper &damper) {
+    for (const auto &pair : damper.states_) {
+      const auto &key = pair.first;
+      const auto &state = pair.second;
+      auto prefix = table::Ipv4Prefix::from_address_and_mask_length(
+        { static_cast<uint32_t>(key.prefix >> 32) }, key.prefix % 64);
+      Ipv4Address next_hop = { static_cast<uint32_t>(key.next_hop) };
+      constexpr char format_string[] = "Flap damping: {} via {} on {} \
+penalty={:.0f}{}, held down {} times, {} re-advertisements ignored";
+      SPDLOG_INFO(format_string, prefix, next_hop, key.next_hop >> 32,
+        state.penalty, state.suppressed ? " (held down)" : "",
+        state.suppression_num, state.ignored_num);
+    }
+  }
+
+  inline void print_triggered_update_stats_to_stderr(
+      const triggering::TriggeredUpdater &updater) {
+    SPDLOG_INFO("Triggered updates: {} sent, {} suppressed",
+      updater.sent_, updater.suppressed_);
+  }
 }
 }
 
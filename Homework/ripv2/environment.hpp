@@ -24,6 +24,21 @@ constexpr std::array<Ipv4Address,
 #endif
 };
 
+constexpr std::array<bool, kInterfaceNum> kPoisonedReverse = {false, false};
+  // ^ Per interface: advertise routes learned there back with metric 16
+  //   instead of omitting them.
+
+constexpr std::array<uint32_t, kInterfaceNum> kPacketsPerMs = {8, 8};
+  // ^ Per interface: at most this many regular update datagrams are sent
+  //   in one millisecond.
+
+constexpr bool kCompressFib = false;
+  // ^ Install an ORTC-compressed FIB. It is rebuilt from scratch on every
+  //   change, clearing all 64 MiB of tbl24 each time.
+
+constexpr char kCheckpointPath[] = "ripv2-table.bin";
+  // ^ Learned routes are saved here and restored on a warm restart.
+
 constexpr Ipv4Address kMulticastIpv4Address
   = Ipv4Address::from_octets(224, 0, 0, 9);
 constexpr MacAddress kMulticastMacAddress
@@ -1,6 +1,12 @@
 #pragma once
 
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
 #include "format/rip.hpp"
+#include "aging.hpp"
+#include "damping.hpp"
 #include "table.hpp"
 
 
@@ -10,48 +16,80 @@ namespace exchanging {
 
 using namespace format;
 
+constexpr size_t kMaxEntryNum = 25;
+  // ^ Per RIP message.
+
 struct RipPacket {
 
   bool is_response_;
   std::vector<table::RoutingTable::Entry> entries_;
 
-  bool from_buffer(rip::PacketHeaderReader header_reader,
-      uint32_t interface_index, Ipv4Address source_address) {
-    if (!rip::PacketValidator{header_reader.ptr_,
-        header_reader.entry_num_}()) {
-      return false;
+  static void write_headers(BigEndianBufferWriter &writer,
+      Ipv4Address source_address, Ipv4Address destination_address,
+      size_t entry_num) {
+    writer.put_u8(4*16+5);  // Version, IHL
+    writer.put_u8(0);  // Type of Service
+    writer.put_u16(20*entry_num+32);  // Total Length
+    writer.put_u32(0);  // Identification, Flags, Fragment Offset
+    writer.put_u8(1);  // Time to Live
+    writer.put_u8(17);  // Protocol
+    writer.put_u16(0);  // Header Checksum
+    writer.put_u32(source_address.data_);  // Source Address
+    writer.put_u32(destination_address.data_);  // Destination Address
+    writer.put_u16(520);  // UDP Source Port
+    writer.put_u16(520);  // UDP Destination Port
+    writer.put_u16(20*entry_num+12);  // UDP Length
+    writer.put_u16(0);  // UDP Checksum
+  }
+
+  static void write_entry(BigEndianBufferWriter &writer,
+      const table::RoutingTable::Entry &entry, bool is_response) {
+    writer.put_u16(!is_response?0:2);  // Address Family Identifier (2)
+    writer.put_u16(0);  // Route Tag (2)
+    writer.put_u32(entry.prefix.address_.data_);  // IP Address (4)
+    writer.put_u32(entry.prefix.mask_.data_);  // Subnet Mask (4)
+    writer.put_u32(entry.next_hop.data_);  // Next Hop (4)
+    writer.put_u32(entry.metric);  // Metric (4)
+  }
+
+  // Bulk form of `write_entry` for `entry_num` consecutive entries. With
+  // SSSE3, the address, mask and metric of an entry are loaded as one
+  // vector, with the next hop put in place of the interface index, and one
+  // byte shuffle puts them in wire order and big-endian. Plain SSE2 needs
+  // four shuffles and shifts for that, which barely beats `write_entry`.
+  static void write_entries(BigEndianBufferWriter &writer,
+      const table::RoutingTable::Entry *entries, size_t entry_num,
+      bool is_response) {
+    using Entry = table::RoutingTable::Entry;
+    static_assert(sizeof(Entry) == 20 && offsetof(Entry, prefix) == 0
+      && offsetof(Entry, metric) == 8 && offsetof(Entry, next_hop) == 16, "");
+    size_t i = 0;
+#ifdef __SSSE3__
+    const uint32_t family_and_tag = !is_response ? 0 : 2 << 16;
+    const __m128i head = _mm_setr_epi32(-1, -1, -1, 0);
+    for (; i<entry_num; ++i) {
+      __m128i fields = _mm_or_si128(_mm_and_si128(head, _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(entries + i))), _mm_slli_si128(
+          _mm_cvtsi32_si128(entries[i].next_hop.data_), 12));
+      fields = _mm_shuffle_epi8(fields, _mm_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 15, 14, 13, 12, 11, 10, 9, 8));
+      writer.put_u32(family_and_tag);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(writer.ptr_), fields);
+      writer.ptr_ += 16;
     }
-    is_response_ = header_reader.read_command() != 1;
-    auto entry_reader = header_reader.first_entry();
-    for (size_t i=0; i<header_reader.entry_num_; ++i) {
-      entries_.push_back({
-        table::Ipv4Prefix {
-          entry_reader.read_ip_address(),
-          entry_reader.read_subnet_mask(),
-        },
-        entry_reader.read_metric() + 1,
-        interface_index,
-        source_address,
-      });
-      entry_reader = entry_reader.next();
+#endif
+    for (; i<entry_num; ++i) {
+      write_entry(writer, entries[i], is_response);
     }
-    return true;
   }
 
   size_t to_buffer(BigEndianBufferWriter &writer, size_t start) const {
     writer.put_u8(!is_response_?1:2);  // command (1)
     writer.put_u8(2);  // version (1)
     writer.put_u16(0);  // must be zero (2)
-    size_t count = 0;
-    for (size_t i=start; i<entries_.size()&&count<25; ++i, ++count) {
-      writer.put_u16(!is_response_?0:2);
-        // ^ Address Family Identifier (2)
-      writer.put_u16(0);  // Route Tag (2)
-      writer.put_u32(entries_[i].prefix.address_.data_);  // IP Address (4)
-      writer.put_u32(entries_[i].prefix.mask_.data_);  // Subnet Mask (4)
-      writer.put_u32(entries_[i].next_hop.data_);  // Next Hop (4)
-      writer.put_u32(entries_[i].metric);  // Metric (4)
-    }
+    start = std::min(start, entries_.size());
+    size_t count = std::min(entries_.size() - start, kMaxEntryNum);
+    write_entries(writer, entries_.data() + start, count, is_response_);
     return count;
   }
 
@@ -59,51 +97,167 @@ struct RipPacket {
       Ipv4Address source_address, Ipv4Address destination_address,
       size_t start) const {
     ip::HeaderWriter ih_writer{writer.ptr_};
-    writer.put_u8(4*16+5);  // Version, IHL
-    writer.put_u8(0);  // Type of Service
-    writer.put_u16(20*entries_.size()+32);  // Total Length
-    writer.put_u32(0);  // Identification, Flags, Fragment Offset
-    writer.put_u8(1);  // Time to Live
-    writer.put_u8(17);  // Protocol
-    writer.ptr_ += 2;  // Header Checksum
-    writer.put_u32(source_address.data_);  // Source Address
-    writer.put_u32(destination_address.data_);  // Destination Address
-    writer.put_u16(520);  // UDP Source Port
-    writer.put_u16(520);  // UDP Destination Port
-    writer.put_u16(20*entries_.size()+12);  // UDP Length
-    writer.put_u16(0);  // UDP Checksum
+    write_headers(writer, source_address, destination_address,
+      std::min(entries_.size() - start, kMaxEntryNum));
     size_t count = to_buffer(writer, start);
     ih_writer.write_header_checksum();
     return count;
   }
 };
 
+// Non-owning view of a received RIP message, which only checks its header.
+// It has no entry iterator: `InputProcessor::process_response` validates
+// and decodes the entries itself, in the same pass, straight from the
+// receive buffer.
+struct RipPacketView {
+
+  rip::PacketHeaderReader header_reader_;
+  uint32_t interface_index_;
+  Ipv4Address source_address_;
+
+  bool is_valid() const {
+    return rip::PacketValidator{header_reader_.ptr_, 0}();
+  }
+
+  bool is_response() const {
+    return header_reader_.read_command() != 1;
+  }
+};
+
 struct InputProcessor {
 
   table::RoutingTable *table_;
+  aging::RouteAger *ager_;
+  damping::FlapDamper *damper_;
+  uint64_t now_;
 
+  // RFC 2453 §3.9.2: the router a route currently goes through is believed
+  // whatever it says, including that the route is gone (metric 16), while
+  // other routers can only offer a better metric. A route restored from a
+  // checkpoint yields to any reachable advertisement. Withdrawals go
+  // through flap damping, and so does any route that would make a prefix
+  // reachable or take it over, so that a held-down next hop cannot.
   void process_entry(table::RoutingTable::Entry entry,
       std::vector<table::RoutingTable::Entry> &changed) {
-    for (auto &e : table_->entries_) {
-      if (entry.prefix == e.prefix) {
-        if (entry.metric < e.metric) {
-          e = entry;
+    uint32_t index = table_->index_of(entry.prefix);
+    if (index == table::kNotFound) {
+      if (entry.metric < table::kInfinityMetric
+          && damper_->readvertise(entry, now_)
+          && table_->add(entry)) {
+        ager_->refresh(entry.prefix, now_);
+        changed.push_back(entry);
+      }
+      return;
+    }
+    auto found = table_->entry(index);
+    bool is_reachable = found.metric < table::kInfinityMetric;
+    if (entry.interface_index == found.interface_index
+        && entry.next_hop == found.next_hop) {
+      if (entry.metric < table::kInfinityMetric) {
+        if (entry.metric != found.metric) {
+          if (!is_reachable && !damper_->readvertise(entry, now_)) {
+            return;
+          }
+          table_->add(entry);
           changed.push_back(entry);
         }
-        return;
+        ager_->refresh(entry.prefix, now_);
+      } else if (is_reachable) {
+        damper_->withdraw(entry, now_);
+        table_->add(entry);
+        ager_->withdraw(entry.prefix, now_);
+        changed.push_back(entry);
+      }
+      return;
+    }
+    if ((entry.metric < found.metric || (table_->stale_[index]
+        && entry.metric < table::kInfinityMetric))
+        && damper_->readvertise(entry, now_)
+        && table_->add(entry)) {
+      ager_->refresh(entry.prefix, now_);
+      changed.push_back(entry);
+    }
+  }
+
+  // `view` must be a valid response. Its entries are validated and decoded
+  // a batch at a time; invalid ones are skipped, as RFC 2453 asks, and
+  // addresses are masked to their prefix. The routes that changed are
+  // appended to `changed`, which the caller owns and reuses, so that
+  // receiving allocates nothing once it has grown.
+  void process_response(const RipPacketView &view,
+      std::vector<table::RoutingTable::Entry> &changed) {
+    const uint8_t *entries = view.header_reader_.first_entry().ptr_;
+    size_t entry_num = view.header_reader_.entry_num_;
+    rip::DecodedEntries decoded;
+    for (size_t i=0; i<entry_num; i+=rip::kEntryBatchSize) {
+      rip::PacketEntryBatchDecoder decoder{
+        entries + i * rip::EntryLayout::kSize,
+        std::min(entry_num - i, rip::kEntryBatchSize)};
+      uint64_t valid = decoder.decode(true, decoded);
+      for (size_t j=0; j<decoder.entry_num_; ++j) {
+        if (valid >> j & 1) {
+          process_entry({
+            table::Ipv4Prefix {
+              { decoded.ip_addresses_[j] & decoded.subnet_masks_[j] },
+              { decoded.subnet_masks_[j] },
+            },
+            std::min(decoded.metrics_[j] + 1, table::kInfinityMetric),
+            view.interface_index_,
+            view.source_address_,
+          }, changed);
+        }
       }
     }
-    table_->entries_.push_back(entry);
-    changed.push_back(entry);
   }
+};
+
+// RFC 2453 §3.9.1 requests. A whole-table request is a single entry of
+// family 0 and metric 16; any other request lists the prefixes wanted,
+// which are answered as they are, without split horizon.
+struct RequestProcessor {
+
+  const table::RoutingTable *table_;
 
-  std::vector<table::RoutingTable::Entry>
-      process_response(const RipPacket &packet) {
-    std::vector<table::RoutingTable::Entry> changed;
-    for (auto e : packet.entries_) {
-      process_entry(e, changed);
+  static bool is_whole_table_request(rip::PacketHeaderReader reader) {
+    auto entry_reader = reader.first_entry();
+    return reader.entry_num_ == 1
+      && entry_reader.read_address_family_identifier() == 0
+      && entry_reader.read_metric() == table::kInfinityMetric;
+  }
+
+  // Turns the specific-entry request in the IP packet at `ptr` into its
+  // response, to be sent back from `local_address`; only the metrics and
+  // the few header fields that differ are rewritten.
+  void answer_in_place(uint8_t *ptr, Ipv4Address local_address) const {
+    ip::HeaderWriter ih_writer{ptr};
+    ih_writer.update_destination_address(
+      ip::HeaderReader{ptr}.read_source_address());
+    ih_writer.update_source_address(local_address);
+    ih_writer.update_time_to_live(64);
+      // ^ Monitoring tools need not be on-link.
+    uint8_t *udp_header = ptr + ip::Layout::kSize;
+    udp::HeaderWriter udp_writer{udp_header};
+    udp_writer.write_destination_port(
+      udp::HeaderReader{udp_header}.read_source_port());
+    udp_writer.write_source_port(520);
+    udp_writer.write_checksum(0);
+    uint8_t *rip_header = udp_header + udp::Layout::kSize;
+    rip::PacketHeaderWriter{rip_header}.write_command(2);
+    auto reader = rip::PacketHeaderReader::from_ip_header_reader({ptr});
+    uint8_t *entry = rip_header + rip::HeaderLayout::kSize;
+    for (size_t i=0; i<reader.entry_num_;
+        ++i, entry+=rip::EntryLayout::kSize) {
+      rip::PacketEntryReader entry_reader{entry};
+      table::RoutingTable::Entry found;
+      Ipv4Address mask = entry_reader.read_subnet_mask();
+      bool is_found = table_->find({entry_reader.read_ip_address() & mask,
+        mask}, found);
+        // ^ RIB prefixes are masked, as received ones are.
+      rip::PacketEntryWriter writer{entry};
+      writer.write_address_family_identifier(2);
+      writer.write_next_hop({0});
+      writer.write_metric(is_found ? found.metric : table::kInfinityMetric);
     }
-    return changed;
   }
 };
 
@@ -115,8 +269,37 @@ struct OutputGenerator {
     return { false, { { table::Ipv4Prefix{0, 0}, 16, 0, 0 } } };
   }
 
-  RipPacket generate_unsolicited_response() const {
-    return { true, table_->entries_ };
+  // Split horizon: routes through `interface_index` are left out of what is
+  // sent there (false is returned), or advertised with metric 16 under
+  // poisoned reverse.
+  static bool advertise(table::RoutingTable::Entry &entry,
+      uint32_t interface_index, bool poisoned_reverse) {
+    if (entry.interface_index == interface_index) {
+      if (!poisoned_reverse) {
+        return false;
+      }
+      entry.metric = table::kInfinityMetric;
+    }
+    return true;
+  }
+
+  static RipPacket generate_response(
+      const std::vector<table::RoutingTable::Entry> &entries,
+      uint32_t interface_index, bool poisoned_reverse) {
+    RipPacket packet{true, {}};
+    packet.entries_.reserve(entries.size());
+    for (auto e : entries) {
+      if (advertise(e, interface_index, poisoned_reverse)) {
+        packet.entries_.push_back(e);
+      }
+    }
+    return packet;
+  }
+
+  RipPacket generate_unsolicited_response(
+      uint32_t interface_index, bool poisoned_reverse) const {
+    return generate_response(table_->entries(),
+      interface_index, poisoned_reverse);
   }
 };
 }
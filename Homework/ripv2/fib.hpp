@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#include "adjacency.hpp"
+#include "aggregation.hpp"
+#include "lpm.hpp"
+#include "table.hpp"
+
+
+namespace ripv2 {
+
+namespace fib {
+
+using namespace format;
+
+// A compiled, read-only view of the reachable routes in a RIB, answering
+// longest prefix match queries for the forwarding path with the index of
+// the adjacency to send through.
+struct Fib {
+
+  static constexpr uint32_t kNoInterface = -1;
+  static constexpr uint32_t kDiscard = lpm::Dir24_8::kValueMask;
+    // ^ Stands for "no route" under a covering route in a compressed FIB.
+  static constexpr size_t kVerificationSamples = 4096;
+
+  lpm::Dir24_8 lpm_;
+  adjacency::AdjacencyTable *adjacencies_;
+
+  bool lookup(Ipv4Address address, uint32_t &adjacency) const {
+    return lpm_.lookup(address.data_, adjacency) && adjacency != kDiscard;
+  }
+
+  bool query(Ipv4Address address, uint32_t &interface_index,
+      Ipv4Address &next_hop) const {
+    uint32_t id;
+    if (!lookup(address, id)) {
+      return false;
+    }
+    const auto &a = adjacencies_->adjacencies_[id];
+    interface_index = a.interface_index;
+    next_hop = a.address;
+    return true;
+  }
+
+  // Batched form of `query` for a burst of destinations: the whole burst
+  // is prefetched before any is looked up. Unroutable ones get
+  // `kNoInterface`; returns how many were routable.
+  // Nothing calls it yet: the HAL hands over one packet per receive call.
+  size_t query_batch(const Ipv4Address *addresses, size_t n,
+      uint32_t *interface_index, Ipv4Address *next_hop) const {
+    for (size_t i=0; i<n; ++i) {
+      lpm_.prefetch(addresses[i].data_);
+    }
+    size_t found = 0;
+    for (size_t i=0; i<n; ++i) {
+      if (query(addresses[i], interface_index[i], next_hop[i])) {
+        ++found;
+      } else {
+        interface_index[i] = kNoInterface;
+      }
+    }
+    return found;
+  }
+
+  uint32_t intern_next_hop(uint32_t interface_index, Ipv4Address address) {
+    return adjacencies_->intern(interface_index, address);
+  }
+
+  // A route whose next hop finds no room in the adjacency table is left
+  // out, as if unreachable; returns whether it was installed.
+  bool install(const table::RoutingTable::Entry &entry) {
+    uint32_t id = intern_next_hop(entry.interface_index, entry.next_hop);
+    if (id == adjacency::kNoAdjacency) {
+      return false;
+    }
+    lpm_.insert(entry.prefix.address_.data_, entry.prefix.mask_length(), id);
+    return true;
+  }
+
+  // Brings the slots of `prefix` in line with its current state in `rib`.
+  // The cost is bounded by the prefix's own range, 2^(24-length) tbl24 slots
+  // (or one 256-slot group beyond /24), plus at most 32 index probes to find
+  // the covering route when it is withdrawn.
+  void update(const table::RoutingTable &rib, table::Ipv4Prefix prefix) {
+    table::RoutingTable::Entry entry;
+    if (rib.find(prefix, entry) && entry.metric < table::kInfinityMetric
+        && install(entry)) {
+      return;
+    }
+    uint32_t parent_slot = 0;
+    for (uint32_t length=prefix.mask_length(); length>0; --length) {
+      table::RoutingTable::Entry parent;
+      if (rib.find(table::Ipv4Prefix::from_address_and_mask_length(
+          prefix.address_, length - 1), parent)
+          && parent.metric < table::kInfinityMetric) {
+        uint32_t id = intern_next_hop(parent.interface_index, parent.next_hop);
+        if (id != adjacency::kNoAdjacency) {
+          parent_slot = lpm::Dir24_8::make_slot(id, length - 1);
+          break;
+        }
+      }
+    }
+    lpm_.remove(prefix.address_.data_, prefix.mask_length(), parent_slot);
+  }
+
+  // Installs an ORTC-compressed equivalent of the reachable routes instead.
+  // Compressed FIBs can only be rebuilt as a whole.
+  void compile_compressed(const table::RoutingTable &rib) {
+    std::vector<aggregation::Route> routes;
+    for (uint32_t i=0; i<rib.size(); ++i) {
+      if (rib.metrics_[i] < table::kInfinityMetric) {
+        const auto &next_hop = rib.next_hops_[rib.next_hop_ids_[i]];
+        uint32_t id = intern_next_hop(next_hop.interface_index,
+          next_hop.address);
+        if (id != adjacency::kNoAdjacency) {
+          routes.push_back({rib.addresses_[i], rib.lengths_[i], id});
+        }
+      }
+    }
+    auto compressed = aggregation::compress(routes);
+#ifdef RIPV2_VERIFY_FIB
+    if (!aggregation::verify_equivalence(routes,
+        compressed, kVerificationSamples, rib.size())) {
+      std::abort();
+    }
+#endif
+    lpm_.clear();
+    for (const auto &route : compressed) {
+      lpm_.insert(route.address, route.length,
+        route.value != aggregation::kNoRoute ? route.value : kDiscard);
+    }
+  }
+
+  void compile(const table::RoutingTable &rib) {
+    lpm_.clear();
+    for (uint32_t i=0; i<rib.size(); ++i) {
+      if (rib.metrics_[i] < table::kInfinityMetric) {
+        install(rib.entry(i));
+      }
+    }
+  }
+};
+
+// Publishes FIB snapshots to lock-free readers with an epoch-based RCU
+// scheme over two copies: the writer updates the copy readers are not using
+// and swaps the `current_` pointer, and before touching that copy again it
+// waits until every reader that might still hold it has left its read-side
+// critical section. Each copy is updated incrementally, so the prefixes
+// changed by a publication are kept in `pending_` and replayed on the other
+// copy at the next one.
+struct Publisher {
+
+  static constexpr size_t kMaxReaders = 8;
+  static constexpr size_t kNoReader = -1;
+  static constexpr uint64_t kQuiescent = 0;
+
+  adjacency::AdjacencyTable adjacencies_;
+  std::array<Fib, 2> copies_{{{{}, &adjacencies_}, {{}, &adjacencies_}}};
+  std::atomic<Fib*> current_{&copies_[0]};
+  std::atomic<uint64_t> epoch_{1};
+  std::array<std::atomic<uint64_t>, kMaxReaders> reader_epochs_{};
+  std::atomic<size_t> reader_num_{0};
+  std::vector<table::Ipv4Prefix> pending_;
+  bool pending_compile_ = true;
+  bool compress_ = false;
+  std::vector<uint8_t> in_use_
+    = std::vector<uint8_t>(adjacency::kMaxAdjacencyNum);
+  std::vector<uint32_t> retiring_;
+
+  // Returns `kNoReader` once `kMaxReaders` are registered.
+  size_t register_reader() {
+    size_t reader = reader_num_.load();
+    do {
+      if (reader == kMaxReaders) {
+        return kNoReader;
+      }
+    } while (!reader_num_.compare_exchange_weak(reader, reader + 1));
+    return reader;
+  }
+
+  const Fib *read_lock(size_t reader) {
+    reader_epochs_[reader].store(epoch_.load());
+    return current_.load();
+  }
+
+  void read_unlock(size_t reader) {
+    reader_epochs_[reader].store(kQuiescent);
+  }
+
+  void synchronize() {
+    uint64_t epoch = ++epoch_;
+    for (size_t i=0; i<reader_num_; ++i) {
+      uint64_t e;
+      while ((e = reader_epochs_[i].load()) != kQuiescent && e < epoch) {}
+    }
+  }
+
+  Fib *acquire_inactive() {
+    Fib *next = current_.load() == &copies_[0] ? &copies_[1] : &copies_[0];
+    synchronize();
+    return next;
+  }
+
+  // Compiles the whole RIB from scratch.
+  void publish(const table::RoutingTable &rib) {
+    Fib *next = acquire_inactive();
+    if (compress_) {
+      next->compile_compressed(rib);
+    } else {
+      next->compile(rib);
+    }
+    current_.store(next);
+    pending_.clear();
+    pending_compile_ = true;
+    reclaim(rib);
+  }
+
+  // Applies only the prefixes in `changed`, which must cover every prefix
+  // added, modified or removed in `rib` since the last publication.
+  void publish(const table::RoutingTable &rib,
+      const std::vector<table::RoutingTable::Entry> &changed) {
+    if (compress_) {
+      publish(rib);
+      return;
+    }
+    Fib *next = acquire_inactive();
+    if (pending_compile_) {
+      next->compile(rib);
+    } else {
+      for (auto prefix : pending_) {
+        next->update(rib, prefix);
+      }
+      for (const auto &e : changed) {
+        next->update(rib, e.prefix);
+      }
+    }
+    current_.store(next);
+    pending_.clear();
+    for (const auto &e : changed) {
+      pending_.push_back(e.prefix);
+    }
+    pending_compile_ = false;
+    reclaim(rib);
+  }
+
+  // A FIB copy only refers to adjacencies of next hops its RIB had when it
+  // was last updated. An adjacency no next hop of `rib` uses is therefore
+  // retired, and released at the next publication if still unused: by then
+  // both copies have been updated past its last use, and the readers of the
+  // copy that last referred to it have left (see `acquire_inactive`).
+  void reclaim(const table::RoutingTable &rib) {
+    std::fill(in_use_.begin(), in_use_.end(), 0);
+    for (const auto &next_hop : rib.next_hops_) {
+      uint32_t id = adjacencies_.find(next_hop.interface_index,
+        next_hop.address);
+      if (id != adjacency::kNoAdjacency) {
+        in_use_[id] = 1;
+      }
+    }
+    for (uint32_t id : retiring_) {
+      if (!in_use_[id]) {
+        adjacencies_.release(id);
+      }
+    }
+    retiring_.clear();
+    for (uint32_t id=0; id<adjacencies_.size(); ++id) {
+      if (!in_use_[id] && !adjacencies_.is_free(id)) {
+        retiring_.push_back(id);
+      }
+    }
+  }
+};
+
+struct ReadGuard {
+
+  Publisher *publisher_;
+  size_t reader_;
+  const Fib *fib_;
+
+  ReadGuard(Publisher &publisher, size_t reader)
+    : publisher_(&publisher), reader_(reader),
+      fib_(publisher.read_lock(reader)) {}
+
+  ReadGuard(const ReadGuard&) = delete;
+  ReadGuard &operator=(const ReadGuard&) = delete;
+
+  ~ReadGuard() {
+    publisher_->read_unlock(reader_);
+  }
+
+  const Fib *operator->() const {
+    return fib_;
+  }
+};
+}
+}
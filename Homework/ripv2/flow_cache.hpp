@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+
+#include "format/common.hpp"
+
+
+namespace ripv2 {
+
+namespace flow_cache {
+
+using namespace format;
+
+// Direct-mapped cache from a destination address to everything needed to
+// send a packet there. Entries are stamped with the generation they were
+// resolved in; bumping the generation invalidates all of them at once.
+struct DestinationCache {
+
+  static constexpr size_t kSize = 1024;
+
+  struct alignas(32) Entry {
+    Ipv4Address destination;
+    uint32_t generation;
+    uint32_t interface_index;
+    Ipv4Address next_hop;
+    MacAddress mac_address;
+  };
+
+  static_assert(sizeof(Entry) == 32, "");
+
+  alignas(64) std::array<Entry, kSize> entries_{};
+  std::atomic<uint32_t> generation_{1};
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+
+  static size_t slot_of(Ipv4Address destination) {
+    return (destination.data_ * static_cast<uint32_t>(2654435761))
+      >> (32 - quick_log2(kSize));
+  }
+
+  uint32_t generation() const {
+    return generation_.load(std::memory_order_acquire);
+  }
+
+  // Called whenever a route or an ARP binding may have changed.
+  void invalidate() {
+    generation_.fetch_add(1, std::memory_order_release);
+  }
+
+  const Entry *find(Ipv4Address destination) {
+    const Entry &e = entries_[slot_of(destination)];
+    if (e.generation == generation() && e.destination == destination) {
+      ++hits_;
+      return &e;
+    }
+    ++misses_;
+    return nullptr;
+  }
+
+  // `generation` must have been read before the data was resolved, so that
+  // an invalidation racing with the resolution leaves the entry stale.
+  const Entry *insert(Ipv4Address destination, uint32_t generation,
+      uint32_t interface_index, Ipv4Address next_hop,
+      const MacAddress &mac_address) {
+    Entry &e = entries_[slot_of(destination)];
+    e = {destination, generation, interface_index, next_hop, mac_address};
+    return &e;
+  }
+};
+}
+}
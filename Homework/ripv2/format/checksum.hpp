@@ -0,0 +1,93 @@
+#pragma once
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "common.hpp"
+
+
+namespace ripv2 {
+
+namespace format {
+
+namespace checksum {
+
+// Folds the carries of a sum of 16-bit words back in (end-around carry).
+inline uint16_t fold(uint64_t sum) {
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return sum;
+}
+
+// One's complement sum (RFC 1071) of the big-endian 16-bit words of the
+// `length` bytes at `ptr`, `length` being even and below 64 KiB. The sum
+// does not depend on byte order, so words are added as the host loads them
+// and the result is swapped once at the end; vector lanes collect 32-bit
+// partial sums, which cannot overflow, even added together, within that
+// length.
+inline uint16_t sum(const uint8_t *ptr, size_t length) {
+  uint64_t total = 0;
+  size_t i = 0;
+#ifdef __AVX2__
+  if (length >= 32) {
+    __m256i partial = _mm256_setzero_si256();
+    for (; i+32<=length; i+=32) {
+      __m256i words = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(ptr + i));
+      partial = _mm256_add_epi32(partial, _mm256_add_epi32(
+        _mm256_and_si256(words, _mm256_set1_epi32(0xffff)),
+          _mm256_srli_epi32(words, 16)));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(partial),
+      _mm256_extracti128_si256(partial, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+    total += static_cast<uint32_t>(_mm_cvtsi128_si32(half));
+  }
+#endif
+#ifdef __SSE2__
+  if (i + 16 <= length) {
+    __m128i partial = _mm_setzero_si128();
+    for (; i+16<=length; i+=16) {
+      __m128i words = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(ptr + i));
+      partial = _mm_add_epi32(partial, _mm_add_epi32(
+        _mm_and_si128(words, _mm_set1_epi32(0xffff)),
+          _mm_srli_epi32(words, 16)));
+    }
+    partial = _mm_add_epi32(partial, _mm_shuffle_epi32(partial, 0x4e));
+    partial = _mm_add_epi32(partial, _mm_shuffle_epi32(partial, 0xb1));
+    total += static_cast<uint32_t>(_mm_cvtsi128_si32(partial));
+  }
+#endif
+  for (; i+4<=length; i+=4) {
+    uint32_t words;
+    std::memcpy(&words, ptr + i, 4);
+    total += words;
+  }
+  if (i + 2 <= length) {
+    uint16_t word;
+    std::memcpy(&word, ptr + i, 2);
+    total += word;
+  }
+  return boost::endian::big_to_native(fold(total));
+}
+
+// Incremental update of `checksum` for one 16-bit word of the data changing
+// from `old_word` to `new_word`, after RFC 1624 eqn. 3. It matches a full
+// recalculation as long as the data cannot sum to zero.
+inline uint16_t update(uint16_t checksum, uint16_t old_word,
+    uint16_t new_word) {
+  uint32_t sum = static_cast<uint16_t>(~checksum);
+  sum += static_cast<uint16_t>(~old_word);
+  sum += new_word;
+  return ~fold(sum);
+}
+}
+}
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstring>
+
+#include <boost/endian/conversion.hpp>
+
 #include "../common.hpp"
 
 
@@ -52,16 +56,45 @@ struct MacAddress {
   }
 };
 
+// Big-endian unsigned integers at possibly unaligned addresses, each
+// accessed with a single load or store plus a byte swap.
+template<typename T> T load_big_endian(const uint8_t *ptr) {
+  static_assert(std::is_unsigned<T>::value, "");
+  T v;
+  std::memcpy(&v, ptr, sizeof(T));
+  return boost::endian::big_to_native(v);
+}
+
+template<typename T> void store_big_endian(uint8_t *ptr, T v) {
+  static_assert(std::is_unsigned<T>::value, "");
+  v = boost::endian::native_to_big(v);
+  std::memcpy(ptr, &v, sizeof(T));
+}
+
+// A big-endian header field of type `T` at byte `Offset` of its header.
+template<typename T, size_t Offset> struct Field {
+
+  using Type = T;
+
+  static constexpr size_t kOffset = Offset;
+  static constexpr size_t kEnd = Offset + sizeof(T);
+
+  static T read(const uint8_t *header) {
+    return load_big_endian<T>(header + kOffset);
+  }
+
+  static void write(uint8_t *header, T v) {
+    store_big_endian<T>(header + kOffset, v);
+  }
+};
+
 struct BigEndianBufferReader {
 
   const uint8_t *ptr_;
 
   template<typename T> T get() {
-    static_assert(std::is_unsigned<T>::value, "");
-    T v = 0;
-    for (size_t i=0; i<sizeof(T); ++i) {
-      v = v * 256 + *ptr_++;
-    }
+    T v = load_big_endian<T>(ptr_);
+    ptr_ += sizeof(T);
     return v;
   }
 
@@ -87,15 +120,8 @@ struct BigEndianBufferWriter {
   uint8_t *ptr_;
 
   template<typename T> void put(T v) {
-    static_assert(std::is_unsigned<T>::value, "");
-    std::array<uint8_t, sizeof(T)> buffer;
-    for (auto it=buffer.rbegin(); it!=buffer.rend(); ++it) {
-      *it = v % 256;
-      v /= 256;
-    }
-    for (auto c : buffer) {
-      *ptr_++ = c;
-    }
+    store_big_endian<T>(ptr_, v);
+    ptr_ += sizeof(T);
   }
 
   void put_u8(uint8_t v) {
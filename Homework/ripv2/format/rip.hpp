@@ -1,6 +1,13 @@
 #pragma once
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "ip.hpp"
+#include "udp.hpp"
 
 
 namespace ripv2 {
@@ -9,36 +16,70 @@ namespace format {
 
 namespace rip {
 
+struct HeaderLayout {
+  using Command = Field<uint8_t, 0>;
+  using Version = Field<uint8_t, 1>;
+  using Zero = Field<uint16_t, 2>;
+  static constexpr size_t kSize = Zero::kEnd;
+};
+
+struct EntryLayout {
+  using AddressFamilyIdentifier = Field<uint16_t, 0>;
+  using RouteTag = Field<uint16_t, 2>;
+  using IpAddress = Field<uint32_t, 4>;
+  using SubnetMask = Field<uint32_t, 8>;
+  using NextHop = Field<uint32_t, 12>;
+  using Metric = Field<uint32_t, 16>;
+  static constexpr size_t kSize = Metric::kEnd;
+};
+
 struct PacketEntryReader {
 
   const uint8_t *ptr_;
 
   uint16_t read_address_family_identifier() const {
-    return BigEndianBufferReader{ptr_}.get_u16();
+    return EntryLayout::AddressFamilyIdentifier::read(ptr_);
   }
 
   uint16_t read_route_tag() const {
-    return BigEndianBufferReader{ptr_+2}.get_u16();
+    return EntryLayout::RouteTag::read(ptr_);
   }
 
   Ipv4Address read_ip_address() const {
-    return { BigEndianBufferReader{ptr_+4}.get_u32() };
+    return { EntryLayout::IpAddress::read(ptr_) };
   }
 
   Ipv4Address read_subnet_mask() const {
-    return { BigEndianBufferReader{ptr_+8}.get_u32() };
+    return { EntryLayout::SubnetMask::read(ptr_) };
   }
 
   Ipv4Address read_next_hop() const {
-    return { BigEndianBufferReader{ptr_+12}.get_u32() };
+    return { EntryLayout::NextHop::read(ptr_) };
   }
 
   uint32_t read_metric() const {
-    return BigEndianBufferReader{ptr_+16}.get_u32();
+    return EntryLayout::Metric::read(ptr_);
   }
 
   PacketEntryReader next() const {
-    return { ptr_ + 20 };
+    return { ptr_ + EntryLayout::kSize };
+  }
+};
+
+struct PacketEntryWriter {
+
+  uint8_t *ptr_;
+
+  void write_address_family_identifier(uint16_t identifier) const {
+    EntryLayout::AddressFamilyIdentifier::write(ptr_, identifier);
+  }
+
+  void write_next_hop(Ipv4Address next_hop) const {
+    EntryLayout::NextHop::write(ptr_, next_hop.data_);
+  }
+
+  void write_metric(uint32_t metric) const {
+    EntryLayout::Metric::write(ptr_, metric);
   }
 };
 
@@ -48,9 +89,12 @@ struct PacketEntryValidator {
 
   bool operator()(bool is_response) const {
     PacketEntryReader reader{ptr_};
-    if ((!is_response && reader.read_address_family_identifier() != 0)
-        || (is_response && reader.read_address_family_identifier() != 2)) {
+    uint16_t identifier = reader.read_address_family_identifier();
+    if ((!is_response && identifier != 0 && identifier != 2)
+        || (is_response && identifier != 2)) {
       return false;
+        // ^ Requests for specific entries carry the family of their
+        //   addresses, whole-table requests carry 0.
     }
     if (reader.read_route_tag() != 0) {
       return false;
@@ -65,6 +109,195 @@ struct PacketEntryValidator {
   }
 };
 
+constexpr size_t kEntryBatchSize = 64;
+
+// The fields of a batch of entries that route processing uses, in host
+// order, as decoded by `PacketEntryBatchDecoder`.
+struct DecodedEntries {
+  uint32_t ip_addresses_[kEntryBatchSize];
+  uint32_t subnet_masks_[kEntryBatchSize];
+  uint32_t metrics_[kEntryBatchSize];
+};
+
+// Validates `entry_num_` (at most `kEntryBatchSize`) consecutive entries as
+// `PacketEntryValidator` does, returning a mask with bit i set when entry i
+// is valid, and optionally decodes them in the same pass. Entries are
+// handled eight (AVX2) or four (SSE2) at a time: five vectors cover their
+// 20-byte entries exactly and, as 5 is coprime with the lane count, each
+// field lands in a distinct lane, so it is picked out with lane masks and
+// permuted into entry order instead of being gathered.
+struct PacketEntryBatchDecoder {
+
+  const uint8_t *ptr_;
+  size_t entry_num_;
+
+  uint64_t validate(bool is_response) const {
+    return run<false>(is_response, nullptr);
+  }
+
+  uint64_t decode(bool is_response, DecodedEntries &entries) const {
+    return run<true>(is_response, &entries);
+  }
+
+  uint64_t all_valid() const {
+    return entry_num_ == kEntryBatchSize ? ~static_cast<uint64_t>(0)
+      : (static_cast<uint64_t>(1) << entry_num_) - 1;
+  }
+
+  template<bool Decode> uint64_t run(bool is_response,
+      DecodedEntries *entries) const {
+    uint64_t valid = 0;
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i+8<=entry_num_; i+=8) {
+      valid |= static_cast<uint64_t>(run_8<Decode>(
+        ptr_ + i * EntryLayout::kSize, is_response, entries, i)) << i;
+    }
+#elif defined(__SSE2__)
+    for (; i+4<=entry_num_; i+=4) {
+      valid |= static_cast<uint64_t>(run_4<Decode>(
+        ptr_ + i * EntryLayout::kSize, is_response, entries, i)) << i;
+    }
+#endif
+    for (; i<entry_num_; ++i) {
+      const uint8_t *ptr = ptr_ + i * EntryLayout::kSize;
+      valid |= static_cast<uint64_t>(
+        PacketEntryValidator{ptr}(is_response)) << i;
+      if (Decode) {
+        PacketEntryReader reader{ptr};
+        entries->ip_addresses_[i] = reader.read_ip_address().data_;
+        entries->subnet_masks_[i] = reader.read_subnet_mask().data_;
+        entries->metrics_[i] = reader.read_metric();
+      }
+    }
+    return valid;
+  }
+
+  // Whether dword `d` of a group of entries is dword `j` of its entry.
+  static constexpr int32_t lane_mask(size_t d, size_t j) {
+    return d % 5 == j ? -1 : 0;
+  }
+
+  // The fields are compared as the host loads them, x86 being
+  // little-endian: AFI 2 with route tag 0 reads 0x200 and metric m reads
+  // m << 24. Only the address and mask are swapped, the latter to test its
+  // contiguity.
+#ifdef __AVX2__
+  // Dword `J` of each entry, out of the lanes of vector `K` that hold one.
+  template<size_t J, size_t K> static __m256i pick_8(__m256i word) {
+    return _mm256_and_si256(word, _mm256_setr_epi32(
+      lane_mask(8*K, J), lane_mask(8*K+1, J), lane_mask(8*K+2, J),
+        lane_mask(8*K+3, J), lane_mask(8*K+4, J), lane_mask(8*K+5, J),
+          lane_mask(8*K+6, J), lane_mask(8*K+7, J)));
+  }
+
+  template<size_t J> static __m256i select_8(
+      __m256i w0, __m256i w1, __m256i w2, __m256i w3, __m256i w4) {
+    __m256i field = _mm256_or_si256(
+      _mm256_or_si256(pick_8<J, 0>(w0), pick_8<J, 1>(w1)),
+        _mm256_or_si256(pick_8<J, 2>(w2),
+          _mm256_or_si256(pick_8<J, 3>(w3), pick_8<J, 4>(w4))));
+    return _mm256_permutevar8x32_epi32(field, _mm256_setr_epi32(
+      J % 8, (5+J) % 8, (10+J) % 8, (15+J) % 8,
+        (20+J) % 8, (25+J) % 8, (30+J) % 8, (35+J) % 8));
+  }
+
+  static __m256i swap_8(__m256i field) {
+    return _mm256_shuffle_epi8(field, _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+  }
+
+  template<bool Decode> static uint32_t run_8(const uint8_t *ptr,
+      bool is_response, DecodedEntries *entries, size_t index) {
+    const __m256i *vectors = reinterpret_cast<const __m256i*>(ptr);
+    __m256i w0 = _mm256_loadu_si256(vectors);
+    __m256i w1 = _mm256_loadu_si256(vectors + 1);
+    __m256i w2 = _mm256_loadu_si256(vectors + 2);
+    __m256i w3 = _mm256_loadu_si256(vectors + 3);
+    __m256i w4 = _mm256_loadu_si256(vectors + 4);
+    __m256i family = select_8<0>(w0, w1, w2, w3, w4);
+    __m256i mask = swap_8(select_8<2>(w0, w1, w2, w3, w4));
+    __m256i metric = select_8<4>(w0, w1, w2, w3, w4);
+    __m256i wrong = _mm256_andnot_si256(
+      _mm256_set1_epi32(is_response ? 0 : 0x200),
+        _mm256_xor_si256(family, _mm256_set1_epi32(is_response ? 0x200 : 0)));
+    wrong = _mm256_or_si256(wrong, _mm256_andnot_si256(mask,
+      _mm256_sub_epi32(_mm256_setzero_si256(), mask)));
+    wrong = _mm256_or_si256(wrong, _mm256_and_si256(metric,
+      _mm256_set1_epi32(0xffffff)));
+    metric = _mm256_srli_epi32(metric, 24);
+    wrong = _mm256_or_si256(wrong, _mm256_andnot_si256(_mm256_set1_epi32(15),
+      _mm256_sub_epi32(metric, _mm256_set1_epi32(1))));
+    if (Decode) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(
+        entries->ip_addresses_ + index),
+          swap_8(select_8<1>(w0, w1, w2, w3, w4)));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(
+        entries->subnet_masks_ + index), mask);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(
+        entries->metrics_ + index), metric);
+    }
+    return _mm256_movemask_ps(_mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(wrong, _mm256_setzero_si256())));
+  }
+#elif defined(__SSE2__)
+  // Dword `J` of each entry, out of the lanes of vector `K` that hold one.
+  template<size_t J, size_t K> static __m128i pick_4(__m128i word) {
+    return _mm_and_si128(word, _mm_setr_epi32(lane_mask(4*K, J),
+      lane_mask(4*K+1, J), lane_mask(4*K+2, J), lane_mask(4*K+3, J)));
+  }
+
+  template<size_t J> static __m128i select_4(
+      __m128i w0, __m128i w1, __m128i w2, __m128i w3, __m128i w4) {
+    __m128i field = _mm_or_si128(
+      _mm_or_si128(pick_4<J, 0>(w0), pick_4<J, 1>(w1)),
+        _mm_or_si128(pick_4<J, 2>(w2),
+          _mm_or_si128(pick_4<J, 3>(w3), pick_4<J, 4>(w4))));
+    return _mm_shuffle_epi32(field, _MM_SHUFFLE(
+      (3+J) % 4, (2+J) % 4, (1+J) % 4, J % 4));
+  }
+
+  static __m128i swap_4(__m128i field) {
+    field = _mm_or_si128(_mm_slli_epi16(field, 8), _mm_srli_epi16(field, 8));
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(field, 0xb1), 0xb1);
+  }
+
+  template<bool Decode> static uint32_t run_4(const uint8_t *ptr,
+      bool is_response, DecodedEntries *entries, size_t index) {
+    const __m128i *vectors = reinterpret_cast<const __m128i*>(ptr);
+    __m128i w0 = _mm_loadu_si128(vectors);
+    __m128i w1 = _mm_loadu_si128(vectors + 1);
+    __m128i w2 = _mm_loadu_si128(vectors + 2);
+    __m128i w3 = _mm_loadu_si128(vectors + 3);
+    __m128i w4 = _mm_loadu_si128(vectors + 4);
+    __m128i family = select_4<0>(w0, w1, w2, w3, w4);
+    __m128i mask = swap_4(select_4<2>(w0, w1, w2, w3, w4));
+    __m128i metric = select_4<4>(w0, w1, w2, w3, w4);
+    __m128i wrong = _mm_andnot_si128(_mm_set1_epi32(is_response ? 0 : 0x200),
+      _mm_xor_si128(family, _mm_set1_epi32(is_response ? 0x200 : 0)));
+    wrong = _mm_or_si128(wrong, _mm_andnot_si128(mask,
+      _mm_sub_epi32(_mm_setzero_si128(), mask)));
+    wrong = _mm_or_si128(wrong, _mm_and_si128(metric,
+      _mm_set1_epi32(0xffffff)));
+    metric = _mm_srli_epi32(metric, 24);
+    wrong = _mm_or_si128(wrong, _mm_andnot_si128(_mm_set1_epi32(15),
+      _mm_sub_epi32(metric, _mm_set1_epi32(1))));
+    if (Decode) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(
+        entries->ip_addresses_ + index),
+          swap_4(select_4<1>(w0, w1, w2, w3, w4)));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(
+        entries->subnet_masks_ + index), mask);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(
+        entries->metrics_ + index), metric);
+    }
+    return _mm_movemask_ps(_mm_castsi128_ps(
+      _mm_cmpeq_epi32(wrong, _mm_setzero_si128())));
+  }
+#endif
+};
+
 struct PacketHeaderReader {
 
   const uint8_t *ptr_;
@@ -72,23 +305,35 @@ struct PacketHeaderReader {
 
   static PacketHeaderReader from_ip_header_reader(ip::HeaderReader reader) {
     size_t total_length = reader.read_total_length();
-    return { reader.ptr_ + 28, (total_length - 32) / 20 };
+    constexpr size_t kOffset = ip::Layout::kSize + udp::Layout::kSize;
+    constexpr size_t kEmptySize = kOffset + HeaderLayout::kSize;
+    return { reader.ptr_ + kOffset, total_length < kEmptySize
+      ? 0 : (total_length - kEmptySize) / EntryLayout::kSize };
   }
 
   uint8_t read_command() const {
-    return BigEndianBufferReader{ptr_}.get_u8();
+    return HeaderLayout::Command::read(ptr_);
   }
 
   uint8_t read_version() const {
-    return BigEndianBufferReader{ptr_+1}.get_u8();
+    return HeaderLayout::Version::read(ptr_);
   }
 
   uint16_t read_zero_after_version() const {
-    return BigEndianBufferReader{ptr_+2}.get_u16();
+    return HeaderLayout::Zero::read(ptr_);
   }
 
   PacketEntryReader first_entry() const {
-    return { ptr_ + 4 };
+    return { ptr_ + HeaderLayout::kSize };
+  }
+};
+
+struct PacketHeaderWriter {
+
+  uint8_t *ptr_;
+
+  void write_command(uint8_t command) const {
+    HeaderLayout::Command::write(ptr_, command);
   }
 };
 
@@ -109,12 +354,13 @@ struct PacketValidator {
     if (header_reader.read_zero_after_version() != 0) {
       return false;
     }
-    auto entry_reader = header_reader.first_entry();
-    for (size_t i=0; i<entry_num_; ++i) {
-      if (!PacketEntryValidator{entry_reader.ptr_}(command!=1)) {
+    const uint8_t *entries = header_reader.first_entry().ptr_;
+    for (size_t i=0; i<entry_num_; i+=kEntryBatchSize) {
+      PacketEntryBatchDecoder decoder{entries + i * EntryLayout::kSize,
+        std::min(entry_num_ - i, kEntryBatchSize)};
+      if (decoder.validate(command != 1) != decoder.all_valid()) {
         return false;
       }
-      entry_reader = entry_reader.next();
     }
     return true;
   }
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "common.hpp"
+
+
+namespace ripv2 {
+
+namespace format {
+
+namespace udp {
+
+struct Layout {
+  using SourcePort = Field<uint16_t, 0>;
+  using DestinationPort = Field<uint16_t, 2>;
+  using Length = Field<uint16_t, 4>;
+  using Checksum = Field<uint16_t, 6>;
+  static constexpr size_t kSize = Checksum::kEnd;
+};
+
+struct HeaderReader {
+
+  const uint8_t *ptr_;
+
+  uint16_t read_source_port() const {
+    return Layout::SourcePort::read(ptr_);
+  }
+
+  uint16_t read_destination_port() const {
+    return Layout::DestinationPort::read(ptr_);
+  }
+
+  uint16_t read_length() const {
+    return Layout::Length::read(ptr_);
+  }
+};
+
+struct HeaderWriter {
+
+  uint8_t *ptr_;
+
+  void write_source_port(uint16_t port) const {
+    Layout::SourcePort::write(ptr_, port);
+  }
+
+  void write_destination_port(uint16_t port) const {
+    Layout::DestinationPort::write(ptr_, port);
+  }
+
+  void write_checksum(uint16_t checksum) const {
+    Layout::Checksum::write(ptr_, checksum);
+  }
+};
+}
+}
+}
@@ -0,0 +1,659 @@
+// Checks the packet codecs, checksums and header rewrites of `format/`
+// against straightforward scalar references on random packets, and reports
+// their throughput next to the references'. Exits with 1 on the first mismatch.
+//
+// Usage: ripv2_format_check [--seed N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+
+#include <fmt/format.h>
+
+#include "format/rip.hpp"
+#include "exchanging.hpp"
+#include "forwarding.hpp"
+
+using namespace ripv2;
+using namespace ripv2::format;
+using exchanging::kMaxEntryNum;
+
+
+constexpr size_t kMessageNum = 4096;
+constexpr size_t kMessageSize = ip::Layout::kSize + udp::Layout::kSize
+  + rip::HeaderLayout::kSize + 25 * rip::EntryLayout::kSize;
+constexpr size_t kRoundNum = 64;
+
+namespace {
+
+// The byte-at-a-time big-endian codec the field layouts replaced.
+template<typename T> T reference_read(const uint8_t *ptr) {
+  T v = 0;
+  for (size_t i=0; i<sizeof(T); ++i) {
+    v = v * 256 + ptr[i];
+  }
+  return v;
+}
+
+template<typename T> void reference_write(uint8_t *ptr, T v) {
+  for (size_t i=sizeof(T); i>0; --i) {
+    ptr[i-1] = v % 256;
+    v /= 256;
+  }
+}
+
+// RFC 1071 as the checksum was first written: 16-bit words summed one at a
+// time, with the carries folded back in at the end.
+uint16_t reference_sum(const uint8_t *ptr, size_t length,
+    size_t skipped = -1) {
+  uint32_t sum = 0;
+  for (size_t i=0; i<length; i+=2) {
+    if (i != skipped) {
+      sum += reference_read<uint16_t>(ptr + i);
+    }
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return sum;
+}
+
+uint16_t reference_header_checksum(const uint8_t *header) {
+  return ~reference_sum(header, header[0] % 16 * 4, 10);
+}
+
+bool reference_is_valid(const uint8_t *header) {
+  return header[0] % 16 >= 5
+    && reference_read<uint16_t>(header + 10)
+      == reference_header_checksum(header);
+}
+
+template<typename F> double seconds_of(F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<uint8_t> random_bytes(size_t n, std::mt19937 &random) {
+  std::vector<uint8_t> bytes(n);
+  for (auto &b : bytes) {
+    b = random();
+  }
+  return bytes;
+}
+
+bool report_mismatch(const char *what, size_t at) {
+  fmt::print(stderr, "{} mismatch at {}\n", what, at);
+  return false;
+}
+
+// Every accessor reads what the reference reads at its field's offset, and
+// every writer changes exactly the bytes the reference writes.
+bool check_field_layouts(std::mt19937 &random) {
+  auto bytes = random_bytes(kMessageNum * kMessageSize, random);
+  for (size_t m=0; m<kMessageNum; ++m) {
+    const uint8_t *p = bytes.data() + m * kMessageSize;
+    const uint8_t *u = p + ip::Layout::kSize;
+    const uint8_t *r = u + udp::Layout::kSize;
+    const uint8_t *e = r + rip::HeaderLayout::kSize;
+    ip::HeaderReader ih{p};
+    udp::HeaderReader uh{u};
+    rip::PacketHeaderReader rh{r, 25};
+    rip::PacketEntryReader eh{e};
+    if (ih.read_ihl() != p[0] % 16
+        || ih.read_total_length() != reference_read<uint16_t>(p + 2)
+        || ih.read_time_to_live() != p[8]
+        || ih.read_header_checksum() != reference_read<uint16_t>(p + 10)
+        || ih.read_source_address().data_ != reference_read<uint32_t>(p + 12)
+        || ih.read_destination_address().data_
+          != reference_read<uint32_t>(p + 16)
+        || uh.read_source_port() != reference_read<uint16_t>(u)
+        || uh.read_destination_port() != reference_read<uint16_t>(u + 2)
+        || uh.read_length() != reference_read<uint16_t>(u + 4)
+        || rh.read_command() != r[0] || rh.read_version() != r[1]
+        || rh.read_zero_after_version() != reference_read<uint16_t>(r + 2)
+        || eh.read_address_family_identifier()
+          != reference_read<uint16_t>(e)
+        || eh.read_route_tag() != reference_read<uint16_t>(e + 2)
+        || eh.read_ip_address().data_ != reference_read<uint32_t>(e + 4)
+        || eh.read_subnet_mask().data_ != reference_read<uint32_t>(e + 8)
+        || eh.read_next_hop().data_ != reference_read<uint32_t>(e + 12)
+        || eh.read_metric() != reference_read<uint32_t>(e + 16)) {
+      return report_mismatch("field read", m);
+    }
+  }
+  for (size_t m=0; m<kMessageNum; ++m) {
+    auto original = random_bytes(kMessageSize, random);
+    auto actual = original, expected = original;
+    uint8_t *p = actual.data(), *q = expected.data();
+    uint32_t a = random(), b = random(), c = random();
+    ip::HeaderWriter{p}.write_time_to_live(a);
+    reference_write<uint8_t>(q + 8, a);
+    ip::HeaderWriter{p}.write_source_address({b});
+    reference_write<uint32_t>(q + 12, b);
+    ip::HeaderWriter{p}.write_destination_address({c});
+    reference_write<uint32_t>(q + 16, c);
+    udp::HeaderWriter{p + 20}.write_source_port(a);
+    reference_write<uint16_t>(q + 20, a);
+    udp::HeaderWriter{p + 20}.write_destination_port(b);
+    reference_write<uint16_t>(q + 22, b);
+    udp::HeaderWriter{p + 20}.write_checksum(c);
+    reference_write<uint16_t>(q + 26, c);
+    rip::PacketHeaderWriter{p + 28}.write_command(a);
+    reference_write<uint8_t>(q + 28, a);
+    rip::PacketEntryWriter{p + 32}.write_address_family_identifier(b);
+    reference_write<uint16_t>(q + 32, b);
+    rip::PacketEntryWriter{p + 32}.write_next_hop({c});
+    reference_write<uint32_t>(q + 44, c);
+    rip::PacketEntryWriter{p + 32}.write_metric(a);
+    reference_write<uint32_t>(q + 48, a);
+    if (actual != expected) {
+      return report_mismatch("field write", m);
+    }
+  }
+  fmt::print("Field layouts match the reference\n");
+  return true;
+}
+
+// Parsing reads every header and entry field of a full response;
+// serializing writes one from a table of 25 routes. Both must give what
+// the reference gives.
+bool report_codec_throughput(std::mt19937 &random) {
+  auto bytes = random_bytes(kMessageNum * kMessageSize, random);
+  uint64_t sum = 0;
+  double layout = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (size_t m=0; m<kMessageNum; ++m) {
+        const uint8_t *p = bytes.data() + m * kMessageSize;
+        ip::HeaderReader ih{p};
+        udp::HeaderReader uh{p + 20};
+        sum += ih.read_total_length() + ih.read_time_to_live()
+          + ih.read_source_address().data_ + uh.read_source_port()
+          + uh.read_length();
+        for (rip::PacketEntryReader e{p + 32}; e.ptr_<p+kMessageSize;
+            e=e.next()) {
+          sum += e.read_address_family_identifier() + e.read_route_tag()
+            + e.read_ip_address().data_ + e.read_subnet_mask().data_
+            + e.read_next_hop().data_ + e.read_metric();
+        }
+      }
+    }
+  });
+  double reference = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (size_t m=0; m<kMessageNum; ++m) {
+        const uint8_t *p = bytes.data() + m * kMessageSize;
+        sum -= reference_read<uint16_t>(p + 2) + p[8]
+          + reference_read<uint32_t>(p + 12) + reference_read<uint16_t>(p + 20)
+          + reference_read<uint16_t>(p + 24);
+        for (const uint8_t *e=p+32; e<p+kMessageSize; e+=20) {
+          sum -= reference_read<uint16_t>(e) + reference_read<uint16_t>(e + 2)
+            + reference_read<uint32_t>(e + 4)
+            + reference_read<uint32_t>(e + 8)
+            + reference_read<uint32_t>(e + 12)
+            + reference_read<uint32_t>(e + 16);
+        }
+      }
+    }
+  });
+  if (sum != 0) {
+    return report_mismatch("parse", 0);
+  }
+  double message_num = kRoundNum * kMessageNum;
+  fmt::print("parse: {:.1f} ns per message, byte at a time {:.1f} ns\n",
+    layout / message_num * 1e9, reference / message_num * 1e9);
+
+  exchanging::RipPacket packet{true, {}};
+  for (size_t i=0; i<25; ++i) {
+    packet.entries_.push_back({table::Ipv4Prefix::from_address_and_mask_length(
+      { static_cast<uint32_t>(random()) }, 8 + random() % 25),
+      static_cast<uint32_t>(1 + random() % 16), 0,
+      { static_cast<uint32_t>(random()) }});
+  }
+  std::vector<uint8_t> actual(kMessageSize), expected(kMessageSize);
+  layout = seconds_of([&] {
+    for (size_t m=0; m<kRoundNum*kMessageNum; ++m) {
+      BigEndianBufferWriter writer{actual.data()};
+      exchanging::RipPacket::write_headers(writer, {1}, {2}, 25);
+      packet.to_buffer(writer, 0);
+      sum += actual[m % kMessageSize];
+        // ^ Keeps the stores from being optimized away.
+    }
+  });
+  reference = seconds_of([&] {
+    for (size_t m=0; m<kRoundNum*kMessageNum; ++m) {
+      uint8_t *q = expected.data();
+      const uint8_t header[] = {0x45, 0, 0x02, 0x14, 0, 0, 0, 0, 1, 17, 0, 0,
+        0, 0, 0, 1, 0, 0, 0, 2, 0x02, 0x08, 0x02, 0x08, 0x02, 0x00, 0, 0,
+        2, 2, 0, 0};
+      for (size_t i=0; i<sizeof(header); ++i) {
+        reference_write<uint8_t>(q + i, header[i]);
+      }
+      q += sizeof(header);
+      for (const auto &e : packet.entries_) {
+        reference_write<uint16_t>(q, 2);
+        reference_write<uint16_t>(q + 2, 0);
+        reference_write<uint32_t>(q + 4, e.prefix.address_.data_);
+        reference_write<uint32_t>(q + 8, e.prefix.mask_.data_);
+        reference_write<uint32_t>(q + 12, e.next_hop.data_);
+        reference_write<uint32_t>(q + 16, e.metric);
+        q += 20;
+      }
+      sum -= expected[m % kMessageSize];
+    }
+  });
+  if (actual != expected) {
+    return report_mismatch("serialize", 0);
+  }
+  fmt::print("serialize: {:.1f} ns per message, byte at a time {:.1f} ns\n",
+    layout / message_num * 1e9, reference / message_num * 1e9);
+  return true;
+}
+
+// IPv4 headers of every length (IHL 5 to 15 mostly, some below 5), each
+// in its own buffer; most carry their correct checksum, the others have a
+// byte changed.
+std::vector<std::vector<uint8_t>> random_headers(size_t n,
+    std::mt19937 &random) {
+  std::vector<std::vector<uint8_t>> headers;
+  for (size_t i=0; i<n; ++i) {
+    auto header = random_bytes(60, random);
+    uint32_t ihl = random() % 16 == 0 ? random() % 5
+      : random() % 2 == 0 ? 5 : 5 + random() % 11;
+    header[0] = 0x40 | ihl;
+    reference_write<uint16_t>(header.data() + 10,
+      reference_header_checksum(header.data()));
+    if (random() % 4 == 0) {
+      header[random() % std::max<uint32_t>(ihl * 4, 1)] ^= 1 + random() % 255;
+    }
+    headers.push_back(std::move(header));
+  }
+  return headers;
+}
+
+// The SIMD checksum kernel, the validator, the checksum writer and the
+// batch validator, against the scalar reference.
+bool check_checksums(std::mt19937 &random) {
+  auto bytes = random_bytes(2048, random);
+  for (size_t i=0; i<4096; ++i) {
+    size_t offset = random() % 64;
+    size_t length = random() % 2 == 0 ? 2 * (random() % 33)
+      : 2 * (random() % 992);
+    if (checksum::sum(bytes.data() + offset, length)
+        != reference_sum(bytes.data() + offset, length)) {
+      return report_mismatch("checksum", i);
+    }
+  }
+  auto headers = random_headers(1 << 14, random);
+  std::vector<const uint8_t*> pointers;
+  for (size_t i=0; i<headers.size(); ++i) {
+    const uint8_t *header = headers[i].data();
+    pointers.push_back(header);
+    if (ip::Validator{header}() != reference_is_valid(header)) {
+      return report_mismatch("validation", i);
+    }
+    if (header[0] % 16 < 5) {
+      continue;
+    }
+    auto copy = headers[i];
+    ip::HeaderWriter{copy.data()}.write_header_checksum();
+    if (reference_read<uint16_t>(copy.data() + 10)
+        != reference_header_checksum(header)) {
+      return report_mismatch("checksum write", i);
+    }
+  }
+  std::unique_ptr<bool[]> valid(new bool[headers.size()]);
+  for (size_t i=0, n=1; i<headers.size(); i+=n, n=n%40+1) {
+    n = std::min(n, headers.size() - i);
+    size_t valid_num = ip::validate_batch(pointers.data() + i, n,
+      valid.get() + i);
+    for (size_t j=i; j<i+n; ++j) {
+      if (valid[j] != reference_is_valid(pointers[j])) {
+        return report_mismatch("batch validation", j);
+      }
+      valid_num -= valid[j];
+    }
+    if (valid_num != 0) {
+      return report_mismatch("batch valid count", i);
+    }
+  }
+  fmt::print("Checksums match the reference\n");
+  return true;
+}
+
+// Validation of headers without options: one at a time, in bursts of 32,
+// and by the reference.
+bool report_checksum_throughput(std::mt19937 &random) {
+  std::vector<std::vector<uint8_t>> headers;
+  for (auto &header : random_headers(1 << 16, random)) {
+    if (header[0] % 16 == 5) {
+      headers.push_back(std::move(header));
+    }
+  }
+  std::vector<const uint8_t*> pointers;
+  for (const auto &header : headers) {
+    pointers.push_back(header.data());
+  }
+  std::unique_ptr<bool[]> valid(new bool[pointers.size()]);
+  size_t single_num = 0, batch_num = 0, reference_num = 0;
+  double single = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (auto header : pointers) {
+        single_num += ip::Validator{header}();
+      }
+    }
+  });
+  double batch = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      size_t i = 0;
+      for (; i+32<=pointers.size(); i+=32) {
+        batch_num += ip::validate_batch(pointers.data() + i, 32,
+          valid.get() + i);
+      }
+      batch_num += ip::validate_batch(pointers.data() + i,
+        pointers.size() - i, valid.get() + i);
+    }
+  });
+  double reference = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (auto header : pointers) {
+        reference_num += reference_is_valid(header);
+      }
+    }
+  });
+  if (single_num != reference_num || batch_num != reference_num) {
+    return report_mismatch("validation count", 0);
+  }
+  double header_num = kRoundNum * pointers.size();
+  fmt::print("validate: {:.2f} ns per header, {:.2f} ns in bursts of 32, "
+    "reference {:.2f} ns\n", single / header_num * 1e9,
+    batch / header_num * 1e9, reference / header_num * 1e9);
+  return true;
+}
+
+// RIP entries that are mostly valid for a response or a request, the
+// others with one field out of range.
+std::vector<uint8_t> random_entries(size_t n, std::mt19937 &random) {
+  using Layout = rip::EntryLayout;
+  auto bytes = random_bytes(n * Layout::kSize, random);
+  for (size_t i=0; i<n; ++i) {
+    uint8_t *entry = bytes.data() + i * Layout::kSize;
+    Layout::AddressFamilyIdentifier::write(entry, random() % 4 == 0 ? 0 : 2);
+    Layout::RouteTag::write(entry, 0);
+    Layout::SubnetMask::write(entry,
+      Ipv4Address::mask_from_length(random() % 33).data_);
+    Layout::Metric::write(entry, 1 + random() % 16);
+    switch (random() % 8) {
+      case 0:
+        Layout::AddressFamilyIdentifier::write(entry, random() % 4);
+        break;
+      case 1:
+        Layout::RouteTag::write(entry, random() % 2);
+        break;
+      case 2:
+        Layout::SubnetMask::write(entry, random());
+        break;
+      case 3:
+        Layout::Metric::write(entry,
+          random() % 2 == 0 ? random() % 18 : random());
+        break;
+    }
+  }
+  return bytes;
+}
+
+// `PacketEntryBatchDecoder` against `PacketEntryValidator` and
+// `PacketEntryReader`, on batches of every length at random offsets.
+bool check_entry_decoding(std::mt19937 &random) {
+  auto bytes = random_entries(1 << 16, random);
+  rip::DecodedEntries decoded;
+  for (size_t k=0; k<(1<<14); ++k) {
+    size_t n = 1 + random() % rip::kEntryBatchSize;
+    const uint8_t *entries = bytes.data()
+      + random() % ((1 << 16) - n) * rip::EntryLayout::kSize;
+    bool is_response = random() % 2 == 0;
+    rip::PacketEntryBatchDecoder decoder{entries, n};
+    uint64_t valid = decoder.decode(is_response, decoded);
+    if (decoder.validate(is_response) != valid || (n < 64 && valid >> n)) {
+      return report_mismatch("entry validation", k);
+    }
+    for (size_t j=0; j<n; ++j) {
+      const uint8_t *entry = entries + j * rip::EntryLayout::kSize;
+      rip::PacketEntryReader reader{entry};
+      if ((valid >> j & 1) != rip::PacketEntryValidator{entry}(is_response)
+          || decoded.ip_addresses_[j] != reader.read_ip_address().data_
+          || decoded.subnet_masks_[j] != reader.read_subnet_mask().data_
+          || ((valid >> j & 1)
+            && decoded.metrics_[j] != reader.read_metric())) {
+        return report_mismatch("entry decoding", k);
+      }
+    }
+  }
+  fmt::print("Entry decoding matches the validator\n");
+  return true;
+}
+
+// Validating and decoding the entries of full responses, in batches and
+// one entry at a time.
+bool report_decoding_throughput(std::mt19937 &random) {
+  auto bytes = random_entries(kMessageNum * kMaxEntryNum, random);
+  rip::DecodedEntries decoded;
+  uint64_t sum = 0;
+  double batched = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (size_t m=0; m<kMessageNum; ++m) {
+        rip::PacketEntryBatchDecoder decoder{bytes.data()
+          + m * kMaxEntryNum * rip::EntryLayout::kSize, kMaxEntryNum};
+        uint64_t valid = decoder.decode(true, decoded);
+        for (size_t j=0; j<kMaxEntryNum; ++j) {
+          sum += (valid >> j & 1) * (decoded.ip_addresses_[j]
+            + decoded.subnet_masks_[j] + decoded.metrics_[j]);
+        }
+      }
+    }
+  });
+  double single = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (size_t i=0; i<kMessageNum*kMaxEntryNum; ++i) {
+        rip::PacketEntryReader reader{bytes.data()
+          + i * rip::EntryLayout::kSize};
+        sum -= rip::PacketEntryValidator{reader.ptr_}(true)
+          * (reader.read_ip_address().data_
+            + reader.read_subnet_mask().data_ + reader.read_metric());
+      }
+    }
+  });
+  if (sum != 0) {
+    return report_mismatch("entry decoding", 0);
+  }
+  double message_num = kRoundNum * kMessageNum;
+  fmt::print("decode: {:.1f} ns per response, one entry at a time {:.1f} "
+    "ns\n", batched / message_num * 1e9, single / message_num * 1e9);
+  return true;
+}
+
+// Routes with random fields, as a table holds them.
+std::vector<table::RoutingTable::Entry> random_routes(size_t n,
+    std::mt19937 &random) {
+  std::vector<table::RoutingTable::Entry> routes;
+  for (size_t i=0; i<n; ++i) {
+    routes.push_back({table::Ipv4Prefix::from_address_and_mask_length(
+      { static_cast<uint32_t>(random()) }, random() % 33),
+      static_cast<uint32_t>(1 + random() % 16),
+      static_cast<uint32_t>(random()), { static_cast<uint32_t>(random()) }});
+  }
+  return routes;
+}
+
+// `write_entries` against a loop of `write_entry`, on runs of every
+// length up to a full message, for requests and responses.
+bool check_entry_encoding(std::mt19937 &random) {
+  auto routes = random_routes(1 << 12, random);
+  std::vector<uint8_t> actual(kMaxEntryNum * rip::EntryLayout::kSize);
+  std::vector<uint8_t> expected(actual.size());
+  for (size_t k=0; k<(1<<14); ++k) {
+    size_t n = random() % (kMaxEntryNum + 1);
+    const auto *entries = routes.data() + random() % (routes.size() - n);
+    bool is_response = random() % 2 == 0;
+    std::fill(actual.begin(), actual.end(), 0);
+    std::fill(expected.begin(), expected.end(), 0);
+    BigEndianBufferWriter writer{actual.data()};
+    exchanging::RipPacket::write_entries(writer, entries, n, is_response);
+    BigEndianBufferWriter reference{expected.data()};
+    for (size_t i=0; i<n; ++i) {
+      exchanging::RipPacket::write_entry(reference, entries[i], is_response);
+    }
+    if (actual != expected || writer.ptr_ != actual.data() + 20 * n) {
+      return report_mismatch("entry encoding", k);
+    }
+  }
+  fmt::print("Entry encoding matches write_entry\n");
+  return true;
+}
+
+// Encoding the entries of full responses, in one run and one entry at a
+// time.
+bool report_encoding_throughput(std::mt19937 &random) {
+  auto routes = random_routes(kMessageNum * kMaxEntryNum, random);
+  std::vector<uint8_t> bytes(kMaxEntryNum * rip::EntryLayout::kSize);
+  uint64_t sum = 0;
+  double run = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (size_t m=0; m<kMessageNum; ++m) {
+        BigEndianBufferWriter writer{bytes.data()};
+        exchanging::RipPacket::write_entries(writer,
+          routes.data() + m * kMaxEntryNum, kMaxEntryNum, true);
+        sum += bytes[m % bytes.size()];
+          // ^ Keeps the stores from being optimized away.
+      }
+    }
+  });
+  double single = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (size_t m=0; m<kMessageNum; ++m) {
+        BigEndianBufferWriter writer{bytes.data()};
+        for (size_t i=0; i<kMaxEntryNum; ++i) {
+          exchanging::RipPacket::write_entry(writer,
+            routes[m * kMaxEntryNum + i], true);
+        }
+        sum -= bytes[m % bytes.size()];
+      }
+    }
+  });
+  if (sum != 0) {
+    return report_mismatch("entry encoding", 0);
+  }
+  double message_num = kRoundNum * kMessageNum;
+  fmt::print("encode: {:.1f} ns per response, one entry at a time {:.1f} "
+    "ns\n", run / message_num * 1e9, single / message_num * 1e9);
+  return true;
+}
+
+// A header of IHL 5 to 15 with its checksum set, its bytes random, all
+// zeros or all ones.
+std::vector<uint8_t> random_checksummed_header(std::mt19937 &random) {
+  uint32_t kind = random() % 8;
+  auto header = kind == 0 ? std::vector<uint8_t>(60, 0)
+    : kind == 1 ? std::vector<uint8_t>(60, 0xff) : random_bytes(60, random);
+  header[0] = 0x40 | (random() % 2 == 0 ? 5 : 5 + random() % 11);
+  ip::HeaderWriter{header.data()}.write_header_checksum();
+  return header;
+}
+
+// Runs of one to four `update_*` writes and forwards on random headers,
+// after each of which the patched checksum must equal a full
+// recalculation.
+bool check_header_updates(std::mt19937 &random) {
+  for (size_t i=0; i<(1<<18); ++i) {
+    auto header = random_checksummed_header(random);
+    ip::HeaderWriter writer{header.data()};
+    for (uint32_t step=random()%4; step<4; ++step) {
+      Ipv4Address address = { static_cast<uint32_t>(random()) };
+      switch (random() % 4) {
+        case 0:
+          writer.update_time_to_live(random());
+          break;
+        case 1:
+          forwarding::forward(writer);
+          break;
+        case 2:
+          writer.update_source_address(address);
+          break;
+        case 3:
+          writer.update_destination_address(address);
+          break;
+      }
+      if (reference_read<uint16_t>(header.data() + 10)
+          != reference_header_checksum(header.data())
+          || !ip::Validator{header.data()}()) {
+        return report_mismatch("header update", i);
+      }
+    }
+  }
+  fmt::print("Header updates match a full recalculation\n");
+  return true;
+}
+
+// Forwarding a header without options: patching the checksum, and writing
+// the time to live then recalculating it.
+bool report_rewrite_throughput(std::mt19937 &random) {
+  std::vector<std::vector<uint8_t>> headers, rewritten;
+  for (size_t i=0; i<kMessageNum; ++i) {
+    auto header = random_bytes(ip::Layout::kSize, random);
+    header[0] = 0x45;
+    ip::HeaderWriter{header.data()}.write_header_checksum();
+    headers.push_back(header);
+  }
+  rewritten = headers;
+  double patched = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (auto &header : headers) {
+        forwarding::forward(ip::HeaderWriter{header.data()});
+      }
+    }
+  });
+  double recalculated = seconds_of([&] {
+    for (size_t round=0; round<kRoundNum; ++round) {
+      for (auto &header : rewritten) {
+        ip::HeaderWriter writer{header.data()};
+        writer.write_time_to_live(
+          ip::HeaderReader{header.data()}.read_time_to_live() - 1);
+        writer.write_header_checksum();
+      }
+    }
+  });
+  if (headers != rewritten) {
+    return report_mismatch("forward", 0);
+  }
+  double header_num = kRoundNum * headers.size();
+  fmt::print("forward: {:.2f} ns per header, recalculated {:.2f} ns\n",
+    patched / header_num * 1e9, recalculated / header_num * 1e9);
+  return true;
+}
+}
+
+int main(int argc, char **argv) {
+  uint32_t seed = 1;
+  if (argc == 3 && std::strcmp(argv[1], "--seed") == 0) {
+    seed = std::strtoul(argv[2], nullptr, 10);
+  } else if (argc != 1) {
+    fmt::print(stderr, "usage: {} [--seed N]\n", argv[0]);
+    return 2;
+  }
+  std::mt19937 random(seed);
+  bool passed = check_field_layouts(random)
+    && report_codec_throughput(random)
+    && check_checksums(random)
+    && report_checksum_throughput(random)
+    && check_header_updates(random)
+    && report_rewrite_throughput(random)
+    && check_entry_decoding(random)
+    && report_decoding_throughput(random)
+    && check_entry_encoding(random)
+    && report_encoding_throughput(random);
+  return passed ? 0 : 1;
+}
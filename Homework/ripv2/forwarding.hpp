@@ -11,8 +11,7 @@ using namespace format;
 
 inline void forward(ip::HeaderWriter writer) {
   uint8_t time_to_live = ip::HeaderReader{writer.ptr_}.read_time_to_live() - 1;
-  writer.write_time_to_live(time_to_live);
-  writer.write_header_checksum();
+  writer.update_time_to_live(time_to_live);
 }
 }
 }
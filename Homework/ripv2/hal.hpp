@@ -30,25 +30,28 @@ inline bool init() {
   return result == 0;
 }
 
-inline bool send_ip_packet(const uint8_t *buffer, size_t length,
-    uint32_t interface_index, Ipv4Address destination_address) {
-  MacAddress destination_mac_address;
-  if (destination_address == kMulticastIpv4Address) {
-    destination_mac_address = kMulticastMacAddress;
+inline bool resolve_mac_address(uint32_t interface_index,
+    Ipv4Address address, MacAddress &mac_address) {
+  if (address == kMulticastIpv4Address) {
+    mac_address = kMulticastMacAddress;
+    return true;
+  }
+  constexpr char format_string[]
+    = "Try to query MAC address of {} from interface {}...";
+  SPDLOG_DEBUG(format_string, address, interface_index);
+  int result = HAL_ArpGetMacAddress(interface_index,
+    endian_reverse(address.data_), mac_address.data_.data());
+  if (result != 0) {
+    SPDLOG_DEBUG("    ...failed (code: {})", result);
+    return false;
   } else {
-    constexpr char format_string[]
-      = "Try to query MAC address of {} from interface {}...";
-    SPDLOG_DEBUG(format_string, destination_address, interface_index);
-    int result = HAL_ArpGetMacAddress(interface_index,
-      endian_reverse(destination_address.data_),
-        destination_mac_address.data_.data());
-    if (result != 0) {
-      SPDLOG_DEBUG("    ...failed (code: {})", result);
-      return false;
-    } else {
-      SPDLOG_DEBUG("    ...done: {}", destination_mac_address);
-    }
+    SPDLOG_DEBUG("    ...done: {}", mac_address);
+    return true;
   }
+}
+
+inline bool send_ip_packet(const uint8_t *buffer, size_t length,
+    uint32_t interface_index, const MacAddress &destination_mac_address) {
   constexpr char format_string[]
     = "Try to send an IP packet of length {} to {} by interface {}...";
   SPDLOG_DEBUG(format_string, length,
@@ -65,13 +68,24 @@ inline bool send_ip_packet(const uint8_t *buffer, size_t length,
   }
 }
 
-inline int receive_ip_packet(uint8_t *buffer,
-    size_t capacity, uint32_t &interface_index) {
+inline bool send_ip_packet(const uint8_t *buffer, size_t length,
+    uint32_t interface_index, Ipv4Address destination_address) {
+  MacAddress destination_mac_address;
+  if (!resolve_mac_address(interface_index,
+      destination_address, destination_mac_address)) {
+    return false;
+  }
+  return send_ip_packet(buffer, length,
+    interface_index, destination_mac_address);
+}
+
+inline int receive_ip_packet(uint8_t *buffer, size_t capacity,
+    uint64_t timeout, uint32_t &interface_index) {
   MacAddress source, destination;
   int32_t interface_index_as_signed;
   int result = HAL_ReceiveIPPacket((1<<kInterfaceNum)-1,
     buffer, capacity, source.data_.data(), destination.data_.data(),
-      1000, &interface_index_as_signed);
+      timeout, &interface_index_as_signed);
   if (result == 0) {
     return 2;
   }
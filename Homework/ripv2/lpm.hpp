@@ -0,0 +1,168 @@
+#pragma once
+
+#include "common.hpp"
+
+
+namespace ripv2 {
+
+namespace lpm {
+
+// DIR-24-8 longest prefix match: the first 24 bits of an address index
+// `tbl24_` directly, and only slots covered by prefixes longer than /24 are
+// extended to a 256-slot group in `tbl8_`, so every lookup costs at most two
+// memory accesses. Each slot also records the depth of the prefix it came
+// from, which lets insertions and removals touch only their own range.
+struct Dir24_8 {
+
+  static constexpr uint32_t kValueMask = (static_cast<uint32_t>(1) << 24) - 1;
+  static constexpr uint32_t kDepthShift = 24;
+  static constexpr uint32_t kValidFlag = static_cast<uint32_t>(1) << 30;
+  static constexpr uint32_t kExtendedFlag = static_cast<uint32_t>(1) << 31;
+  static constexpr size_t kTbl24Size = static_cast<size_t>(1) << 24;
+  static constexpr size_t kGroupSize = 256;
+  static constexpr uint32_t kNoValue = -1;
+
+  std::vector<uint32_t> tbl24_ = std::vector<uint32_t>(kTbl24Size);
+  std::vector<uint32_t> tbl8_;
+  std::vector<uint32_t> free_groups_;
+
+  static constexpr uint32_t make_slot(uint32_t value, uint32_t depth) {
+    return kValidFlag | depth << kDepthShift | value;
+  }
+
+  static constexpr uint32_t depth_of(uint32_t slot) {
+    return (slot >> kDepthShift) % 64;
+  }
+
+  static constexpr bool is_overridden_by(uint32_t slot, uint32_t depth) {
+    return !(slot & kValidFlag) || depth_of(slot) <= depth;
+  }
+
+  static constexpr bool belongs_to(uint32_t slot, uint32_t depth) {
+    return (slot & kValidFlag) && depth_of(slot) == depth;
+  }
+
+  bool lookup(uint32_t address, uint32_t &value) const {
+    uint32_t slot = tbl24_[address >> 8];
+    if (slot & kExtendedFlag) {
+      slot = tbl8_[(slot & kValueMask) * kGroupSize + address % 256];
+    }
+    value = slot & kValueMask;
+    return slot & kValidFlag;
+  }
+
+  // Starts loading the tbl24 slot of `address`, so that the lookups of a
+  // burst can have their cache misses overlap instead of serializing.
+  void prefetch(uint32_t address) const {
+    __builtin_prefetch(&tbl24_[address >> 8]);
+  }
+
+  // `address` must already be masked to `depth` bits.
+  void insert(uint32_t address, uint32_t depth, uint32_t value) {
+    uint32_t slot = make_slot(value, depth);
+    if (depth <= 24) {
+      size_t begin = address >> 8;
+      size_t end = begin + (static_cast<size_t>(1) << (24 - depth));
+      for (size_t i=begin; i<end; ++i) {
+        if (tbl24_[i] & kExtendedFlag) {
+          overwrite_group(tbl24_[i] & kValueMask, 0, kGroupSize, depth, slot);
+        } else if (is_overridden_by(tbl24_[i], depth)) {
+          tbl24_[i] = slot;
+        }
+      }
+    } else {
+      uint32_t group = extend(address >> 8);
+      size_t begin = address % 256;
+      size_t end = begin + (static_cast<size_t>(1) << (32 - depth));
+      overwrite_group(group, begin, end, depth, slot);
+    }
+  }
+
+  // Slots owned by the removed prefix fall back to `parent_slot`, which is
+  // either 0 (no covering prefix) or `make_slot` of the longest prefix
+  // covering the removed one.
+  void remove(uint32_t address, uint32_t depth, uint32_t parent_slot) {
+    if (depth <= 24) {
+      size_t begin = address >> 8;
+      size_t end = begin + (static_cast<size_t>(1) << (24 - depth));
+      for (size_t i=begin; i<end; ++i) {
+        if (tbl24_[i] & kExtendedFlag) {
+          replace_in_group(tbl24_[i] & kValueMask,
+            0, kGroupSize, depth, parent_slot);
+          try_collapse(i);
+        } else if (belongs_to(tbl24_[i], depth)) {
+          tbl24_[i] = parent_slot;
+        }
+      }
+    } else if (tbl24_[address >> 8] & kExtendedFlag) {
+      size_t begin = address % 256;
+      size_t end = begin + (static_cast<size_t>(1) << (32 - depth));
+      replace_in_group(tbl24_[address >> 8] & kValueMask,
+        begin, end, depth, parent_slot);
+      try_collapse(address >> 8);
+    }
+  }
+
+  void clear() {
+    std::fill(tbl24_.begin(), tbl24_.end(), 0);
+    tbl8_.clear();
+    free_groups_.clear();
+  }
+
+  size_t memory_usage() const {
+    return (tbl24_.size() + tbl8_.size()) * sizeof(uint32_t);
+  }
+
+  void overwrite_group(uint32_t group, size_t begin, size_t end,
+      uint32_t depth, uint32_t slot) {
+    uint32_t *base = tbl8_.data() + group * kGroupSize;
+    for (size_t j=begin; j<end; ++j) {
+      if (is_overridden_by(base[j], depth)) {
+        base[j] = slot;
+      }
+    }
+  }
+
+  void replace_in_group(uint32_t group, size_t begin, size_t end,
+      uint32_t depth, uint32_t parent_slot) {
+    uint32_t *base = tbl8_.data() + group * kGroupSize;
+    for (size_t j=begin; j<end; ++j) {
+      if (belongs_to(base[j], depth)) {
+        base[j] = parent_slot;
+      }
+    }
+  }
+
+  uint32_t extend(size_t index) {
+    if (tbl24_[index] & kExtendedFlag) {
+      return tbl24_[index] & kValueMask;
+    }
+    uint32_t group;
+    if (!free_groups_.empty()) {
+      group = free_groups_.back();
+      free_groups_.pop_back();
+    } else {
+      group = tbl8_.size() / kGroupSize;
+      tbl8_.resize(tbl8_.size() + kGroupSize);
+    }
+    std::fill_n(tbl8_.begin() + group * kGroupSize, kGroupSize, tbl24_[index]);
+    tbl24_[index] = kExtendedFlag | group;
+    return group;
+  }
+
+  void try_collapse(size_t index) {
+    uint32_t group = tbl24_[index] & kValueMask;
+    auto begin = tbl8_.cbegin() + group * kGroupSize;
+    uint32_t first = *begin;
+    if ((first & kValidFlag) && depth_of(first) > 24) {
+      return;
+    }
+    if (std::all_of(begin, begin + kGroupSize,
+        [first](uint32_t slot) { return slot == first; })) {
+      tbl24_[index] = first;
+      free_groups_.push_back(group);
+    }
+  }
+};
+}
+}
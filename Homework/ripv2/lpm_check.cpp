@@ -0,0 +1,310 @@
+// Checks the DIR-24-8 FIB against a reference longest prefix matcher (the
+// binary trie of `aggregation.hpp`) on random tables, across full compiles
+// and incremental withdrawals, checks batched queries against single ones,
+// and reports lookup and forwarding throughput at 1k, 10k and 100k
+// prefixes, single and batched. Exits with 1 on the first mismatch.
+//
+// Usage: ripv2_lpm_check [--seed N]
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include <fmt/format.h>
+
+#include "aggregation.hpp"
+#include "fib.hpp"
+#include "forwarding.hpp"
+#include "table.hpp"
+
+using namespace ripv2;
+using namespace ripv2::fib;
+using namespace ripv2::format;
+using namespace ripv2::table;
+
+
+constexpr uint32_t kNextHopNum = 16;
+constexpr size_t kSampleNum = 1 << 20;
+constexpr size_t kBurstSize = 32;
+constexpr std::array<size_t, 3> kTableSizes = {1000, 10000, 100000};
+
+namespace {
+
+// Next hop `k` is 10.255.0.k on interface k % 4, so it can be told from
+// what a lookup returns.
+Ipv4Address next_hop_of(uint32_t k) {
+  return { Ipv4Address::from_octets(10, 255, 0, 0).data_ + k };
+}
+
+// Mostly /16 to /24 as in real tables, with some shorter and longer ones.
+uint32_t random_length(std::mt19937 &random) {
+  uint32_t r = random() % 100;
+  return r < 10 ? 8 + random() % 8 : r < 85 ? 16 + random() % 9
+    : 25 + random() % 8;
+}
+
+void fill(RoutingTable &rib, size_t route_num, std::mt19937 &random) {
+  while (rib.size() < route_num) {
+    uint32_t k = random() % kNextHopNum;
+    rib.add({Ipv4Prefix::from_address_and_mask_length(
+      { static_cast<uint32_t>(random()) }, random_length(random)),
+      static_cast<uint32_t>(1 + random() % 15), k % 4, next_hop_of(k)});
+  }
+}
+
+aggregation::Trie reference_of(const RoutingTable &rib) {
+  aggregation::Trie trie;
+  for (uint32_t i=0; i<rib.size(); ++i) {
+    auto e = rib.entry(i);
+    if (e.metric < kInfinityMetric) {
+      trie.insert({e.prefix.address_.data_, e.prefix.mask_length(),
+        e.next_hop.data_ % 256});
+    }
+  }
+  return trie;
+}
+
+// Half of the addresses fall inside routes of `rib`, so that sparse tables
+// are exercised too.
+std::vector<Ipv4Address> sample_addresses(const RoutingTable &rib,
+    size_t n, std::mt19937 &random) {
+  std::vector<Ipv4Address> addresses(n);
+  for (size_t i=0; i<n; ++i) {
+    uint32_t address = random();
+    if (i % 2 == 0 && rib.size() != 0) {
+      auto prefix = rib.prefix(random() % rib.size());
+      address = prefix.address_.data_ | (address & ~prefix.mask_.data_);
+    }
+    addresses[i] = {address};
+  }
+  return addresses;
+}
+
+bool matches_reference(const Fib &fib, const RoutingTable &rib,
+    const std::vector<Ipv4Address> &addresses) {
+  auto reference = reference_of(rib);
+  for (auto address : addresses) {
+    uint32_t interface_index;
+    Ipv4Address next_hop;
+    uint32_t expected = reference.lookup(address.data_);
+    bool found = fib.query(address, interface_index, next_hop);
+    if (found != (expected != aggregation::kNoRoute) || (found
+        && (next_hop.data_ % 256 != expected
+          || interface_index != expected % 4))) {
+      fmt::print(stderr, "mismatch at {:08x}: expected {}, got {}\n",
+        address.data_, expected,
+        found ? static_cast<int>(next_hop.data_ % 256) : -1);
+      return false;
+    }
+  }
+  return true;
+}
+
+// `query_batch` must agree with `query` on every address of a burst,
+// whatever its length.
+bool batch_matches_single(const Fib &fib,
+    const std::vector<Ipv4Address> &addresses) {
+  std::vector<uint32_t> interface_indexes(kBurstSize);
+  std::vector<Ipv4Address> next_hops(kBurstSize);
+  for (size_t i=0, n=1; i<addresses.size(); i+=n, n=n%kBurstSize+1) {
+    n = std::min(n, addresses.size() - i);
+    size_t found = fib.query_batch(addresses.data() + i, n,
+      interface_indexes.data(), next_hops.data());
+    for (size_t j=0; j<n; ++j) {
+      uint32_t interface_index;
+      Ipv4Address next_hop;
+      if (fib.query(addresses[i+j], interface_index, next_hop)) {
+        --found;
+        if (interface_indexes[j] != interface_index
+            || next_hops[j] != next_hop) {
+          fmt::print(stderr, "batch mismatch at {:08x}\n",
+            addresses[i+j].data_);
+          return false;
+        }
+      } else if (interface_indexes[j] != Fib::kNoInterface) {
+        fmt::print(stderr, "batch found {:08x}\n", addresses[i+j].data_);
+        return false;
+      }
+    }
+    if (found != 0) {
+      fmt::print(stderr, "batch miscounted at {}\n", i);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool matches(const Fib &fib, const RoutingTable &rib,
+    const std::vector<Ipv4Address> &addresses) {
+  return matches_reference(fib, rib, addresses)
+    && batch_matches_single(fib, addresses);
+}
+
+// Compiles a random table, then withdraws and deletes routes a few at a
+// time through incremental updates, comparing with the reference after each
+// step.
+bool check_against_reference(size_t route_num, std::mt19937 &random) {
+  RoutingTable rib;
+  fill(rib, route_num, random);
+  adjacency::AdjacencyTable adjacencies;
+  Fib fib{{}, &adjacencies};
+  fib.compile(rib);
+  if (!matches(fib, rib, sample_addresses(rib, 1 << 16, random))) {
+    return false;
+  }
+  for (uint32_t step=0; step<8 && rib.size()>0; ++step) {
+    for (size_t n=0; n<route_num/16 && rib.size()>0; ++n) {
+      auto e = rib.entry(random() % rib.size());
+      if (random() % 2 == 0) {
+        e.metric = kInfinityMetric;
+        rib.add(e);
+      } else {
+        rib.remove(e.prefix);
+      }
+      fib.update(rib, e.prefix);
+    }
+    if (!matches(fib, rib, sample_addresses(rib, 1 << 16, random))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Full queries (next hop included), one at a time and in bursts.
+void report_batch_throughput(const Fib &fib,
+    const std::vector<Ipv4Address> &addresses) {
+  uint64_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (auto address : addresses) {
+    uint32_t interface_index;
+    Ipv4Address next_hop;
+    if (fib.query(address, interface_index, next_hop)) {
+      sum += interface_index + next_hop.data_;
+    }
+  }
+  auto single = std::chrono::steady_clock::now();
+  std::array<uint32_t, kBurstSize> interface_indexes;
+  std::array<Ipv4Address, kBurstSize> next_hops;
+  for (size_t i=0; i+kBurstSize<=addresses.size(); i+=kBurstSize) {
+    fib.query_batch(addresses.data() + i, kBurstSize,
+      interface_indexes.data(), next_hops.data());
+    for (size_t j=0; j<kBurstSize; ++j) {
+      if (interface_indexes[j] != Fib::kNoInterface) {
+        sum -= interface_indexes[j] + next_hops[j].data_;
+      }
+    }
+  }
+  auto batched = std::chrono::steady_clock::now();
+  fmt::print("  queries: {:.1f} M/s one at a time, {:.1f} M/s in bursts "
+    "of {} (checksum {})\n", addresses.size() / 1e6
+    / std::chrono::duration<double>(single - start).count(),
+    addresses.size() / 1e6
+    / std::chrono::duration<double>(batched - single).count(),
+    kBurstSize, sum);
+}
+
+// Forwarding as the router would: each packet's header is validated, its
+// destination looked up and its time to live decremented. One packet at a
+// time, the lookups sit between header work and barely overlap; in bursts,
+// the destinations of a burst are looked up together first.
+void report_forwarding_throughput(const Fib &fib,
+    const std::vector<Ipv4Address> &addresses) {
+  std::vector<uint8_t> headers(addresses.size() * ip::Layout::kSize);
+  for (size_t i=0; i<addresses.size(); ++i) {
+    uint8_t *header = headers.data() + i * ip::Layout::kSize;
+    ip::Layout::VersionAndIhl::write(header, 0x45);
+    ip::Layout::TimeToLive::write(header, 64);
+    ip::HeaderWriter{header}.write_destination_address(addresses[i]);
+    ip::HeaderWriter{header}.write_header_checksum();
+  }
+  uint64_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i=0; i<addresses.size(); ++i) {
+    uint8_t *header = headers.data() + i * ip::Layout::kSize;
+    uint32_t interface_index;
+    Ipv4Address next_hop;
+    if (ip::Validator{header}() && fib.query(
+        ip::HeaderReader{header}.read_destination_address(),
+        interface_index, next_hop)) {
+      forwarding::forward(ip::HeaderWriter{header});
+      sum += interface_index + next_hop.data_;
+    }
+  }
+  auto single = std::chrono::steady_clock::now();
+  std::array<Ipv4Address, kBurstSize> destinations;
+  std::array<uint32_t, kBurstSize> interface_indexes;
+  std::array<Ipv4Address, kBurstSize> next_hops;
+  for (size_t i=0; i+kBurstSize<=addresses.size(); i+=kBurstSize) {
+    uint8_t *burst = headers.data() + i * ip::Layout::kSize;
+    for (size_t j=0; j<kBurstSize; ++j) {
+      destinations[j] = ip::HeaderReader{burst + j * ip::Layout::kSize}
+        .read_destination_address();
+    }
+    fib.query_batch(destinations.data(), kBurstSize,
+      interface_indexes.data(), next_hops.data());
+    for (size_t j=0; j<kBurstSize; ++j) {
+      uint8_t *header = burst + j * ip::Layout::kSize;
+      if (ip::Validator{header}()
+          && interface_indexes[j] != Fib::kNoInterface) {
+        forwarding::forward(ip::HeaderWriter{header});
+        sum -= interface_indexes[j] + next_hops[j].data_;
+      }
+    }
+  }
+  auto batched = std::chrono::steady_clock::now();
+  fmt::print("  forwarding: {:.1f} M/s one at a time, {:.1f} M/s in bursts "
+    "of {} (checksum {})\n", addresses.size() / 1e6
+    / std::chrono::duration<double>(single - start).count(),
+    addresses.size() / 1e6
+    / std::chrono::duration<double>(batched - single).count(),
+    kBurstSize, sum);
+}
+
+void report_throughput(size_t route_num, std::mt19937 &random) {
+  RoutingTable rib;
+  fill(rib, route_num, random);
+  adjacency::AdjacencyTable adjacencies;
+  Fib fib{{}, &adjacencies};
+  auto start = std::chrono::steady_clock::now();
+  fib.compile(rib);
+  auto compiled = std::chrono::steady_clock::now();
+  auto addresses = sample_addresses(rib, kSampleNum, random);
+  uint64_t sum = 0;
+  auto looked_up = std::chrono::steady_clock::now();
+  for (auto address : addresses) {
+    uint32_t id;
+    sum += fib.lookup(address, id) ? id : 0;
+  }
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - looked_up).count();
+  fmt::print("{:>6} prefixes: compiled in {:.1f} ms, {:.1f} M lookups/s, "
+    "{:.1f} MiB (checksum {})\n", route_num,
+    std::chrono::duration<double, std::milli>(compiled - start).count(),
+    addresses.size() / seconds / 1e6,
+    fib.lpm_.memory_usage() / 1048576.0, sum);
+  report_batch_throughput(fib, addresses);
+  report_forwarding_throughput(fib, addresses);
+}
+}
+
+int main(int argc, char **argv) {
+  uint32_t seed = 1;
+  if (argc == 3 && std::strcmp(argv[1], "--seed") == 0) {
+    seed = std::strtoul(argv[2], nullptr, 10);
+  } else if (argc != 1) {
+    fmt::print(stderr, "usage: {} [--seed N]\n", argv[0]);
+    return 2;
+  }
+  std::mt19937 random(seed);
+  for (size_t route_num : {100, 5000}) {
+    if (!check_against_reference(route_num, random)) {
+      return 1;
+    }
+  }
+  fmt::print("FIB matches the reference\n");
+  for (auto route_num : kTableSizes) {
+    report_throughput(route_num, random);
+  }
+  return 0;
+}
@@ -1,22 +1,82 @@
+#include "aging.hpp"
+#include "checkpoint.hpp"
+#include "damping.hpp"
 #include "debug.hpp"
 #include "exchanging.hpp"
+#include "fib.hpp"
+#include "flow_cache.hpp"
 #include "forwarding.hpp"
 #include "hal.hpp"
+#include "pacing.hpp"
+#include "response_cache.hpp"
+#include "triggering.hpp"
 
 using namespace ripv2;
+using namespace ripv2::aging;
+using namespace ripv2::damping;
 using namespace ripv2::debug;
 using namespace ripv2::environment;
 using namespace ripv2::exchanging;
+using namespace ripv2::fib;
+using namespace ripv2::flow_cache;
 using namespace ripv2::forwarding;
+using namespace ripv2::pacing;
+using namespace ripv2::response_cache;
 using namespace ripv2::table;
+using namespace ripv2::triggering;
 
 
 constexpr int kCodeOnInitFailure = 101;
 constexpr size_t kPacketBufferSize = 65536;
 constexpr uint64_t kRegularResponsePeriod = 5000;
+constexpr uint64_t kRegularResponseJitter = 500;
+constexpr uint64_t kRegularResponseSpread = 2500;
+  // ^ Each regular update is sent over this much of its period.
+constexpr uint64_t kReceiveTimeout = 1000;
+constexpr uint64_t kCheckpointPeriod = 30000;
+constexpr uint64_t kArpRevalidationPeriod = 1000;
+  // ^ The HAL does not report ARP changes, so adjacencies are re-queried
+  //   this often.
 
 namespace {
 
+using ResponseCaches = std::array<ResponseCache, kInterfaceNum>;
+
+ResponseCaches make_response_caches() {
+  ResponseCaches caches;
+  for (uint32_t i=0; i<kInterfaceNum; ++i) {
+    caches[i] = { i, kInterfaceAddresses[i],
+      kMulticastIpv4Address, kPoisonedReverse[i], {}, {}, {} };
+  }
+  return caches;
+}
+
+Pacer make_pacer() {
+  Pacer pacer{kRegularResponsePeriod, kRegularResponseJitter,
+    kRegularResponseSpread, std::mt19937(std::random_device{}()), {}};
+  for (uint32_t i=0; i<kInterfaceNum; ++i) {
+    pacer.interfaces_.push_back({kPacketsPerMs[i], 0, 0, 0});
+  }
+  return pacer;
+}
+
+struct ControlPlane {
+  RoutingTable table;
+  FlapDamper damper{};
+  RouteAger ager{&table, &damper};
+  TriggeredUpdater updater{std::random_device{}()};
+  ResponseCaches responses = make_response_caches();
+  Pacer pacer = make_pacer();
+  std::vector<RoutingTable::Entry> changed = {};
+    // ^ Reused for every received response.
+};
+
+struct DataPlane {
+  Publisher publisher;
+  size_t reader_id = publisher.register_reader();
+  DestinationCache cache;
+};
+
 RoutingTable generate_routing_table() {
   RoutingTable table;
   for (size_t i=0; i<kInterfaceNum; ++i) {
@@ -27,6 +87,28 @@ RoutingTable generate_routing_table() {
   return table;
 }
 
+// Restores the checkpointed routes as stale: they forward traffic at once,
+// but time out like any other route and yield to the first advertisement.
+void restore_checkpoint(ControlPlane &control_plane, uint64_t current_time) {
+  std::vector<RoutingTable::Entry> entries;
+  if (!checkpoint::load(kCheckpointPath, entries)) {
+    SPDLOG_INFO("No usable checkpoint at {}", kCheckpointPath);
+    return;
+  }
+  auto &table = control_plane.table;
+  size_t restored = 0;
+  for (const auto &e : entries) {
+    if (e.interface_index >= kInterfaceNum
+        || table.index_of(e.prefix) != kNotFound || !table.add(e)) {
+      continue;
+    }
+    control_plane.ager.refresh(e.prefix, current_time);
+    table.stale_[table.index_of(e.prefix)] = true;
+    ++restored;
+  }
+  SPDLOG_INFO("Restored {} stale routes from {}", restored, kCheckpointPath);
+}
+
 void send_rip_packet(const RipPacket &packet, uint8_t *buffer,
     uint32_t interface_index, Ipv4Address destination_address) {
   for (size_t count=0; count<packet.entries_.size(); ) {
@@ -41,70 +123,199 @@ void send_rip_packet(const RipPacket &packet, uint8_t *buffer,
 
 void generate_complete_response(const RoutingTable &table, uint8_t *buffer,
     uint32_t interface_index, Ipv4Address destination_address) {
-  auto packet = OutputGenerator{&table}.generate_unsolicited_response();
+  auto packet = OutputGenerator{&table}.generate_unsolicited_response(
+    interface_index, kPoisonedReverse[interface_index]);
   send_rip_packet(packet, buffer, interface_index, destination_address);
 }
 
-void generate_unsolicited_response(
-    const RoutingTable &table, uint8_t *buffer) {
-  auto packet = OutputGenerator{&table}.generate_unsolicited_response();
-  for (size_t i=0; i<kInterfaceNum; ++i) {
-    send_rip_packet(packet, buffer, i, kMulticastIpv4Address);
+void send_paced_responses(ControlPlane &control_plane,
+    uint64_t current_time) {
+  for (const auto &response : control_plane.responses) {
+    control_plane.pacer.send_due(current_time, response.interface_index_,
+        response.datagram_num(), [&](size_t i) {
+      hal::send_ip_packet(response.datagram(i), response.datagram_length(i),
+        response.interface_index_, kMulticastIpv4Address);
+    });
+  }
+}
+
+// Waits for packets no longer than until the next paced or triggered
+// update is due.
+uint64_t receive_timeout(const ControlPlane &control_plane,
+    uint64_t current_time) {
+  const auto &pacer = control_plane.pacer;
+  uint64_t timeout = std::min(kReceiveTimeout,
+    pacer.next_round_ - std::min(pacer.next_round_, current_time));
+  for (const auto &response : control_plane.responses) {
+    timeout = std::min(timeout, pacer.time_to_next(current_time,
+      response.interface_index_, response.datagram_num()));
   }
+  const auto &updater = control_plane.updater;
+  if (!updater.pending_.empty()) {
+    timeout = std::min(timeout, updater.hold_down_end_
+      - std::min(updater.hold_down_end_, current_time));
+  }
+  return timeout;
 }
 
-void process_exchanging(RoutingTable &table,
-    uint8_t *buffer, uint32_t interface_index) {
-  RipPacket packet;
+void send_triggered_update(
+    const std::vector<RoutingTable::Entry> &changed, uint8_t *buffer) {
+  for (uint32_t i=0; i<kInterfaceNum; ++i) {
+    auto packet = OutputGenerator::generate_response(
+      changed, i, kPoisonedReverse[i]);
+    if (!packet.entries_.empty()) {
+      send_rip_packet(packet, buffer, i, kMulticastIpv4Address);
+    }
+  }
+}
+
+void commit_changes(ControlPlane &control_plane, DataPlane &data_plane,
+    const std::vector<RoutingTable::Entry> &changed,
+    const std::vector<Ipv4Prefix> &removed = {}) {
+  if (changed.empty() && removed.empty()) {
+    return;
+  }
+  const auto &table = control_plane.table;
+  if (!changed.empty()) {
+    const auto &adjacencies = data_plane.publisher.adjacencies_;
+    size_t refused = adjacencies.refused_;
+    data_plane.publisher.publish(table, changed);
+    data_plane.cache.invalidate();
+    if (adjacencies.refused_ != refused) {
+      SPDLOG_WARN("Adjacency table full, {} FIB installs refused",
+        adjacencies.refused_ - refused);
+    }
+  }
+  for (auto &response : control_plane.responses) {
+    for (const auto &e : changed) {
+      response.update(table, e.prefix);
+    }
+    for (auto prefix : removed) {
+      response.update(table, prefix);
+    }
+  }
+  control_plane.updater.note(changed);
+}
+
+// Where to send a packet for `destination`: the destination cache, or else
+// the FIB and the adjacency it gives. ARP is asked when that adjacency is
+// not resolved yet, or is the glean adjacency of a directly connected
+// route, in which case the destination itself is the next hop.
+const DestinationCache::Entry *resolve_destination(DataPlane &data_plane,
+    Ipv4Address destination) {
+  auto cached = data_plane.cache.find(destination);
+  if (cached) {
+    return cached;
+  }
+  uint32_t generation = data_plane.cache.generation();
+  uint32_t interface_index;
+  Ipv4Address next_hop;
+  MacAddress mac_address;
+  bool resolved;
+  {
+    ReadGuard fib{data_plane.publisher, data_plane.reader_id};
+    uint32_t id;
+    if (!fib->lookup(destination, id)) {
+      return nullptr;
+    }
+    const auto &adjacencies = *fib->adjacencies_;
+    const auto &adjacency = adjacencies.adjacencies_[id];
+    interface_index = adjacency.interface_index;
+    next_hop = adjacency.address;
+    resolved = next_hop.data_ != 0
+      && adjacencies.read_link(id, mac_address);
+  }
+  if (next_hop.data_ == 0) {
+    next_hop = destination;
+  }
+  if (!resolved && !hal::resolve_mac_address(interface_index,
+      next_hop, mac_address)) {
+    return nullptr;
+  }
+  return data_plane.cache.insert(destination, generation,
+    interface_index, next_hop, mac_address);
+}
+
+void process_exchanging(ControlPlane &control_plane, DataPlane &data_plane,
+    uint8_t *buffer, uint32_t interface_index, uint64_t current_time) {
   auto reader = rip::PacketHeaderReader::from_ip_header_reader({buffer});
   Ipv4Address source_address = ip::HeaderReader{buffer}.read_source_address();
-  if (packet.from_buffer(reader, interface_index, source_address)) {
-    if (!packet.is_response_) {
-      generate_complete_response(table, buffer,
-        interface_index, source_address);
-    } else {
-      auto changed = InputProcessor{&table}.process_response(packet);
-      for (size_t i=0; i<kInterfaceNum; ++i) {
-        std::vector<RoutingTable::Entry> to_send;
-        for (auto e : changed) {
-          if (e.interface_index != i) {
-            to_send.push_back(e);
-          }
-        }
-        if (!to_send.empty()) {
-          send_rip_packet({true, to_send}, buffer, i, kMulticastIpv4Address);
+  RipPacketView view{reader, interface_index, source_address};
+  if (view.is_valid()) {
+    auto &table = control_plane.table;
+    if (!view.is_response()) {
+      if (reader.entry_num_ == 0
+          || !rip::PacketValidator{reader.ptr_, reader.entry_num_}()) {
+        return;
+      }
+      if (RequestProcessor::is_whole_table_request(reader)) {
+        generate_complete_response(table, buffer,
+          interface_index, source_address);
+      } else {
+        RequestProcessor{&table}.answer_in_place(buffer,
+          kInterfaceAddresses[interface_index]);
+        auto route = resolve_destination(data_plane, source_address);
+          // ^ The requester may be a monitoring tool several hops away.
+        if (route) {
+          hal::send_ip_packet(buffer, ip::HeaderReader{buffer}
+            .read_total_length(), route->interface_index, route->mac_address);
         }
       }
+    } else {
+      auto &changed = control_plane.changed;
+      changed.clear();
+      InputProcessor{&table, &control_plane.ager,
+        &control_plane.damper, current_time}.process_response(view, changed);
+      commit_changes(control_plane, data_plane, changed);
     }
   }
 }
 
-void process_forwarding(RoutingTable &table, uint8_t *buffer) {
+void process_forwarding(DataPlane &data_plane, uint8_t *buffer) {
   ip::HeaderReader reader{buffer};
-  uint32_t interface_index;
-  Ipv4Address next_hop;
-  if (table.query(reader.read_destination_address(),
-      interface_index, next_hop)) {
-    if (next_hop.data_ == 0) {
-      next_hop = reader.read_destination_address();
+  auto cached = resolve_destination(data_plane,
+    reader.read_destination_address());
+  if (!cached) {
+    return;
+  }
+  forward(ip::HeaderWriter{buffer});
+  hal::send_ip_packet(buffer, reader.read_total_length(),
+    cached->interface_index, cached->mac_address);
+}
+
+// Re-queries ARP for the neighbors the RIB has routes through. Hosts behind
+// glean adjacencies are only remembered by the destination cache, which is
+// flushed every time, so that those still receiving traffic are queried
+// again as it arrives.
+void refresh_adjacencies(const RoutingTable &table, DataPlane &data_plane) {
+  auto &adjacencies = data_plane.publisher.adjacencies_;
+  for (const auto &next_hop : table.next_hops_) {
+    uint32_t id = adjacencies.find(next_hop.interface_index,
+      next_hop.address);
+    if (next_hop.address.data_ == 0 || id == adjacency::kNoAdjacency) {
+      continue;
     }
-    forward(ip::HeaderWriter{buffer});
-    hal::send_ip_packet(buffer, reader.read_total_length(),
-      interface_index, next_hop);
+    MacAddress mac_address{};
+    bool resolved = hal::resolve_mac_address(next_hop.interface_index,
+      next_hop.address, mac_address);
+    adjacencies.update(id, resolved, mac_address);
   }
+  data_plane.cache.invalidate();
 }
 
-void process_incoming_packet(RoutingTable &table, uint8_t *buffer) {
+void process_incoming_packet(ControlPlane &control_plane,
+    DataPlane &data_plane, uint8_t *buffer, uint64_t current_time) {
   uint32_t interface_index;
-  int receive_result = hal::receive_ip_packet(buffer,
-    kPacketBufferSize, interface_index);
+  int receive_result = hal::receive_ip_packet(buffer, kPacketBufferSize,
+    receive_timeout(control_plane, current_time), interface_index);
   if (receive_result != 0) {
     return;
   }
   if (destination_is_me(ip::HeaderReader{buffer}.read_destination_address())) {
-    process_exchanging(table, buffer, interface_index);
+    process_exchanging(control_plane, data_plane,
+      buffer, interface_index, current_time);
   } else {
-    process_forwarding(table, buffer);
+    process_forwarding(data_plane, buffer);
   }
 }
 }
@@ -116,17 +327,55 @@ int main() {
   if (!hal::init()) {
     return kCodeOnInitFailure;
   }
-  auto table = generate_routing_table();
-  uint64_t last_time = HAL_GetTicks();
+  ControlPlane control_plane{generate_routing_table()};
+  auto &table = control_plane.table;
+  uint64_t start_time = HAL_GetTicks();
+  uint64_t last_arp_time = start_time;
+  uint64_t last_checkpoint_time = start_time;
+  checkpoint::Writer checkpoint_writer{kCheckpointPath};
+  control_plane.ager.start(start_time);
+  restore_checkpoint(control_plane, start_time);
+  for (auto &response : control_plane.responses) {
+    response.rebuild(table);
+  }
+  DataPlane data_plane;
+  if (data_plane.reader_id == Publisher::kNoReader) {
+    SPDLOG_CRITICAL("No FIB reader slot left");
+    return kCodeOnInitFailure;
+  }
+  data_plane.publisher.compress_ = kCompressFib;
+  data_plane.publisher.publish(table);
   uint8_t buffer[kPacketBufferSize];
   while (true) {
     uint64_t current_time = HAL_GetTicks();
-    if (current_time >= last_time + kRegularResponsePeriod) {
-      last_time = current_time;
+    std::vector<RoutingTable::Entry> expired;
+    std::vector<Ipv4Prefix> removed;
+    control_plane.ager.advance(current_time, expired, removed);
+    commit_changes(control_plane, data_plane, expired, removed);
+    auto &updater = control_plane.updater;
+    if (updater.is_due(current_time)) {
+      send_triggered_update(updater.flush(table, current_time), buffer);
+    }
+    if (current_time >= last_arp_time + kArpRevalidationPeriod) {
+      last_arp_time = current_time;
+      refresh_adjacencies(table, data_plane);
+    }
+    if (current_time >= last_checkpoint_time + kCheckpointPeriod) {
+      last_checkpoint_time = current_time;
+      if (!checkpoint_writer.save(table)) {
+        SPDLOG_WARN("Failed to save checkpoint to {}", kCheckpointPath);
+      }
+    }
+    if (control_plane.pacer.is_round_due(current_time)) {
+      control_plane.pacer.start_round(current_time);
       print_routing_table_to_stderr(table);
-      generate_unsolicited_response(table, buffer);
-    } else {
-      process_incoming_packet(table, buffer);
+      print_flow_cache_stats_to_stderr(data_plane.cache);
+      print_triggered_update_stats_to_stderr(updater);
+      control_plane.damper.forget(current_time);
+      print_damping_stats_to_stderr(control_plane.damper);
+      updater.on_regular_update();
     }
+    send_paced_responses(control_plane, current_time);
+    process_incoming_packet(control_plane, data_plane, buffer, current_time);
   }
 }
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <random>
+
+#include "common.hpp"
+
+
+namespace ripv2 {
+
+namespace pacing {
+
+constexpr uint64_t kNothingDue = -1;
+
+// Paces the regular updates. Rounds start every `period_` give or take a
+// random `jitter_` (RFC 2453 §3.8), so that routers do not synchronize, and
+// the datagrams of each interface are spread evenly over the first
+// `spread_` of the round instead of going out back to back. On top of
+// that, no interface sends more than its budget of datagrams in one
+// millisecond.
+struct Pacer {
+
+  struct Progress {
+    uint32_t packets_per_ms;
+    size_t sent;
+    uint64_t budget_time;
+    uint32_t budget_used;
+  };
+
+  uint64_t period_;
+  uint64_t jitter_;
+  uint64_t spread_;
+  std::mt19937 random_;
+  std::vector<Progress> interfaces_;
+  uint64_t round_start_ = 0;
+  uint64_t next_round_ = 0;
+
+  bool is_round_due(uint64_t now) const {
+    return now >= next_round_;
+  }
+
+  // Whatever the previous round had not sent yet is dropped.
+  void start_round(uint64_t now) {
+    round_start_ = now;
+    next_round_ = now + period_ - jitter_
+      + std::uniform_int_distribution<uint64_t>(0, 2 * jitter_)(random_);
+    for (auto &interface : interfaces_) {
+      interface.sent = 0;
+    }
+  }
+
+  // Number of datagrams out of `total` that should be out by `now`.
+  size_t target(uint64_t now, size_t total) const {
+    uint64_t elapsed = now - round_start_;
+    if (elapsed >= spread_) {
+      return total;
+    }
+    return elapsed * total / spread_ + 1;
+  }
+
+  // Sends, through `send(datagram_index)`, what interface
+  // `interface_index` owes out of its `total` datagrams.
+  template<typename F> void send_due(uint64_t now, uint32_t interface_index,
+      size_t total, F send) {
+    auto &interface = interfaces_[interface_index];
+    size_t target = std::min(this->target(now, total), total);
+    if (interface.budget_time != now) {
+      interface.budget_time = now;
+      interface.budget_used = 0;
+    }
+    while (interface.sent < target
+        && interface.budget_used < interface.packets_per_ms) {
+      send(interface.sent);
+      ++interface.sent;
+      ++interface.budget_used;
+    }
+  }
+
+  // Milliseconds until interface `interface_index`, with `total`
+  // datagrams, next has something to send, or `kNothingDue` within this
+  // round.
+  uint64_t time_to_next(uint64_t now, uint32_t interface_index,
+      size_t total) const {
+    const auto &interface = interfaces_[interface_index];
+    if (interface.sent >= total) {
+      return kNothingDue;
+    }
+    if (interface.budget_time == now
+        && interface.budget_used >= interface.packets_per_ms) {
+      return 1;
+    }
+    uint64_t due = round_start_
+      + (interface.sent * spread_ + total - 1) / total;
+    return due > now ? due - now : 0;
+  }
+};
+}
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "aging.hpp"
+#include "exchanging.hpp"
+#include "table.hpp"
+
+
+namespace ripv2 {
+
+namespace response_cache {
+
+using namespace format;
+
+// The periodic response of one interface, kept as ready-to-send datagrams
+// (IP + UDP + RIP) of up to 25 entries each. A changed route only rewrites
+// its own 20-byte entry; an added or withdrawn one also rewrites the
+// headers of one datagram, as the last entry is moved into the hole. When
+// nothing changed, the datagrams are sent verbatim.
+struct ResponseCache {
+
+  static constexpr size_t kDatagramSize = 32 + 20 * exchanging::kMaxEntryNum;
+
+  uint32_t interface_index_;
+  Ipv4Address source_address_;
+  Ipv4Address destination_address_;
+  bool poisoned_reverse_;
+  std::vector<uint8_t> buffer_;
+  std::vector<uint64_t> keys_;
+    // ^ Prefix of each cached entry, in the `aging::RouteAger::key_of` form.
+  std::unordered_map<uint64_t, uint32_t> positions_;
+
+  size_t datagram_num() const {
+    return (keys_.size() + exchanging::kMaxEntryNum - 1)
+      / exchanging::kMaxEntryNum;
+  }
+
+  const uint8_t *datagram(size_t index) const {
+    return buffer_.data() + index * kDatagramSize;
+  }
+
+  size_t datagram_length(size_t index) const {
+    size_t entry_num = std::min(keys_.size()
+      - index * exchanging::kMaxEntryNum, exchanging::kMaxEntryNum);
+    return 20 * entry_num + 32;
+  }
+
+  void rebuild(const table::RoutingTable &table) {
+    buffer_.clear();
+    keys_.clear();
+    positions_.clear();
+    for (uint32_t i=0; i<table.size(); ++i) {
+      auto entry = table.entry(i);
+      if (exchanging::OutputGenerator::advertise(entry,
+          interface_index_, poisoned_reverse_)) {
+        append(entry);
+      }
+    }
+  }
+
+  // Brings the cached entry of `prefix` in line with `table`, where the
+  // route may have changed, appeared or been deleted.
+  void update(const table::RoutingTable &table, table::Ipv4Prefix prefix) {
+    auto it = positions_.find(aging::RouteAger::key_of(prefix));
+    table::RoutingTable::Entry entry;
+    if (table.find(prefix, entry) && exchanging::OutputGenerator::advertise(
+        entry, interface_index_, poisoned_reverse_)) {
+      if (it != positions_.end()) {
+        write_entry(it->second, entry);
+      } else {
+        append(entry);
+      }
+    } else if (it != positions_.end()) {
+      erase(it->second);
+    }
+  }
+
+  void append(const table::RoutingTable::Entry &entry) {
+    uint32_t position = keys_.size();
+    if (position % exchanging::kMaxEntryNum == 0) {
+      buffer_.resize(buffer_.size() + kDatagramSize);
+    }
+    keys_.push_back(aging::RouteAger::key_of(entry.prefix));
+    positions_[keys_.back()] = position;
+    write_entry(position, entry);
+    write_headers(position / exchanging::kMaxEntryNum);
+  }
+
+  void erase(uint32_t position) {
+    uint32_t last = keys_.size() - 1;
+    positions_.erase(keys_[position]);
+    if (position != last) {
+      std::copy_n(entry_at(last), 20, entry_at(position));
+      keys_[position] = keys_[last];
+      positions_[keys_[position]] = position;
+    }
+    keys_.pop_back();
+    if (last % exchanging::kMaxEntryNum == 0) {
+      buffer_.resize(buffer_.size() - kDatagramSize);
+    } else {
+      write_headers(last / exchanging::kMaxEntryNum);
+    }
+  }
+
+  uint8_t *entry_at(uint32_t position) {
+    return buffer_.data() + position / exchanging::kMaxEntryNum
+      * kDatagramSize + 32 + position % exchanging::kMaxEntryNum * 20;
+  }
+
+  void write_entry(uint32_t position,
+      const table::RoutingTable::Entry &entry) {
+    BigEndianBufferWriter writer{entry_at(position)};
+    exchanging::RipPacket::write_entry(writer, entry, true);
+  }
+
+  void write_headers(size_t index) {
+    uint8_t *ptr = buffer_.data() + index * kDatagramSize;
+    BigEndianBufferWriter writer{ptr};
+    exchanging::RipPacket::write_headers(writer, source_address_,
+      destination_address_, (datagram_length(index) - 32) / 20);
+    writer.put_u8(2);  // command (1)
+    writer.put_u8(2);  // version (1)
+    writer.put_u16(0);  // must be zero (2)
+    ip::HeaderWriter{ptr}.write_header_checksum();
+  }
+};
+}
+}
@@ -0,0 +1,509 @@
+// In-process RIPv2 network: many routers, each with the control plane of
+// `main.cpp` (RIB, ager, flap damper, triggered updater and response
+// caches), exchange real RIP datagrams over in-memory links driven by a
+// virtual clock, and the run reports convergence time, traffic and CPU
+// time per router.
+//
+// Usage: ripv2_simulator chain|ring|grid|random ROUTERS ROUTES
+//          [--seed N] [--fail-at MS] [--poison]
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+
+#include <fmt/format.h>
+
+#include "aging.hpp"
+#include "damping.hpp"
+#include "exchanging.hpp"
+#include "response_cache.hpp"
+#include "table.hpp"
+#include "triggering.hpp"
+
+using namespace ripv2;
+using namespace ripv2::aging;
+using namespace ripv2::damping;
+using namespace ripv2::exchanging;
+using namespace ripv2::format;
+using namespace ripv2::response_cache;
+using namespace ripv2::table;
+using namespace ripv2::triggering;
+
+
+constexpr uint64_t kRegularResponsePeriod = 5000;
+constexpr uint64_t kRegularResponseJitter = 500;
+constexpr uint64_t kLinkLatency = 1;
+constexpr uint64_t kQuietPeriod = 3 * kRegularResponsePeriod;
+  // ^ The network is taken as converged once no route changed for this long.
+constexpr uint64_t kHorizon = 3600000;
+constexpr uint64_t kNoEvent = std::numeric_limits<uint64_t>::max();
+constexpr uint32_t kNoPayload = -1;
+constexpr Ipv4Address kMulticastIpv4Address
+  = Ipv4Address::from_octets(224, 0, 0, 9);
+
+namespace {
+
+struct Port {
+  uint32_t peer;
+  uint32_t peer_port;
+  uint32_t link;
+  Ipv4Address address;
+  bool up;
+};
+
+struct Router {
+  std::vector<Port> ports;
+  RoutingTable table;
+  FlapDamper damper;
+  RouteAger ager{&table, &damper};
+  TriggeredUpdater updater;
+  std::vector<ResponseCache> responses;
+  uint64_t triggered_at = kNoEvent;
+  uint64_t message_num = 0;
+  uint64_t byte_num = 0;
+  uint64_t cpu_time = 0;
+    // ^ In nanoseconds.
+
+  explicit Router(uint32_t seed) : updater(seed) {}
+};
+
+enum class EventKind { kRegular, kTriggered, kDelivery, kFailure };
+
+struct Event {
+  uint64_t time;
+  uint64_t sequence;
+  EventKind kind;
+  uint32_t router;
+  uint32_t port;
+  uint32_t payload;
+    // ^ Index in `Network::payloads_` for deliveries, else `kNoPayload`.
+
+  bool operator>(const Event &other) const {
+    return time != other.time ? time > other.time : sequence > other.sequence;
+  }
+};
+
+struct Options {
+  std::string topology;
+  uint32_t router_num;
+  uint32_t route_num;
+  uint32_t seed = 1;
+  uint64_t fail_at = kNoEvent;
+  bool poisoned_reverse = false;
+};
+
+struct Network {
+
+  Options options_;
+  std::mt19937 random_;
+  std::vector<std::unique_ptr<Router>> routers_;
+  std::vector<std::pair<uint32_t, uint32_t>> links_;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+  uint64_t sequence_ = 0;
+  std::vector<std::vector<uint8_t>> payloads_;
+  std::vector<uint32_t> free_payloads_;
+  uint64_t now_ = 0;
+  uint64_t last_change_ = 0;
+  std::vector<RoutingTable::Entry> changed_;
+    // ^ Reused for every delivered response.
+
+  explicit Network(const Options &options)
+    : options_(options), random_(options.seed) {}
+
+  void connect(uint32_t a, uint32_t b) {
+    uint32_t link = links_.size();
+    links_.push_back({a, b});
+    uint32_t subnet = Ipv4Address::from_octets(172, 16, 0, 0).data_ + 4*link;
+    auto &ra = *routers_[a], &rb = *routers_[b];
+    ra.ports.push_back({b, static_cast<uint32_t>(rb.ports.size()),
+      link, { subnet + 1 }, true});
+    rb.ports.push_back({a, static_cast<uint32_t>(ra.ports.size() - 1),
+      link, { subnet + 2 }, true});
+  }
+
+  bool is_linked(uint32_t a, uint32_t b) const {
+    for (const auto &port : routers_[a]->ports) {
+      if (port.peer == b) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool build_topology() {
+    uint32_t n = options_.router_num;
+    for (uint32_t i=0; i<n; ++i) {
+      routers_.emplace_back(new Router(random_()));
+    }
+    const auto &topology = options_.topology;
+    if (topology == "chain" || topology == "ring") {
+      for (uint32_t i=0; i+1<n; ++i) {
+        connect(i, i + 1);
+      }
+      if (topology == "ring" && n > 2) {
+        connect(n - 1, 0);
+      }
+    } else if (topology == "grid") {
+      uint32_t width = 1;
+      while (width * width < n) {
+        ++width;
+      }
+      for (uint32_t i=0; i<n; ++i) {
+        if (i % width + 1 < width && i + 1 < n) {
+          connect(i, i + 1);
+        }
+        if (i + width < n) {
+          connect(i, i + width);
+        }
+      }
+    } else if (topology == "random") {
+      for (uint32_t i=1; i<n; ++i) {
+        connect(random_() % i, i);
+          // ^ A random spanning tree keeps the graph connected.
+      }
+      for (uint32_t extra=0; extra<n/2; ++extra) {
+        uint32_t a = random_() % n, b = random_() % n;
+        if (a != b && !is_linked(a, b)) {
+          connect(a, b);
+        }
+      }
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  static Ipv4Prefix stub_prefix(uint32_t index) {
+    return Ipv4Prefix::from_address_and_mask_length(
+      { Ipv4Address::from_octets(10, 0, 0, 0).data_ + (index << 8) }, 24);
+  }
+
+  uint32_t stub_num() const {
+    return options_.route_num / options_.router_num;
+  }
+
+  // Each router owns its link subnets and `stub_num()` /24s, all directly
+  // connected; stubs hang off an interface no neighbor sits on.
+  void configure_routers() {
+    for (uint32_t r=0; r<routers_.size(); ++r) {
+      auto &router = *routers_[r];
+      uint32_t stub_interface = router.ports.size();
+      for (uint32_t p=0; p<router.ports.size(); ++p) {
+        router.table.add({Ipv4Prefix::from_address_and_mask_length(
+          router.ports[p].address, 30), 1, p, {0}});
+        router.responses.push_back({ p, router.ports[p].address,
+          kMulticastIpv4Address, options_.poisoned_reverse, {}, {}, {} });
+      }
+      for (uint32_t k=0; k<stub_num(); ++k) {
+        router.table.add({stub_prefix(r * stub_num() + k),
+          1, stub_interface, {0}});
+      }
+      for (auto &response : router.responses) {
+        response.rebuild(router.table);
+      }
+      schedule(random_() % kRegularResponsePeriod,
+        EventKind::kRegular, r, 0, kNoPayload);
+    }
+  }
+
+  void schedule(uint64_t time, EventKind kind, uint32_t router,
+      uint32_t port, uint32_t payload) {
+    events_.push({time, sequence_++, kind, router, port, payload});
+  }
+
+  void send(uint32_t r, uint32_t p, const uint8_t *datagram, size_t length) {
+    auto &router = *routers_[r];
+    const auto &port = router.ports[p];
+    if (!port.up) {
+      return;
+    }
+    ++router.message_num;
+    router.byte_num += length;
+    uint32_t payload;
+    if (!free_payloads_.empty()) {
+      payload = free_payloads_.back();
+      free_payloads_.pop_back();
+    } else {
+      payload = payloads_.size();
+      payloads_.emplace_back();
+    }
+    payloads_[payload].assign(datagram, datagram + length);
+    schedule(now_ + kLinkLatency, EventKind::kDelivery,
+      port.peer, port.peer_port, payload);
+  }
+
+  void send_triggered_update(uint32_t r,
+      const std::vector<RoutingTable::Entry> &entries) {
+    auto &router = *routers_[r];
+    uint8_t buffer[ResponseCache::kDatagramSize];
+    for (uint32_t p=0; p<router.ports.size(); ++p) {
+      auto packet = OutputGenerator::generate_response(
+        entries, p, options_.poisoned_reverse);
+      for (size_t count=0; count<packet.entries_.size(); ) {
+        BigEndianBufferWriter writer{buffer};
+        size_t current = packet.to_buffer_with_ip_header(writer,
+          router.ports[p].address, kMulticastIpv4Address, count);
+        send(r, p, buffer, 20*current+32);
+        count += current;
+      }
+    }
+  }
+
+  void commit(uint32_t r, const std::vector<RoutingTable::Entry> &changed,
+      const std::vector<Ipv4Prefix> &removed) {
+    auto &router = *routers_[r];
+    if (changed.empty() && removed.empty()) {
+      return;
+    }
+    last_change_ = now_;
+    for (auto &response : router.responses) {
+      for (const auto &e : changed) {
+        response.update(router.table, e.prefix);
+      }
+      for (auto prefix : removed) {
+        response.update(router.table, prefix);
+      }
+    }
+    router.updater.note(changed);
+    flush_triggered_update(r);
+  }
+
+  void flush_triggered_update(uint32_t r) {
+    auto &router = *routers_[r];
+    if (router.updater.is_due(now_)) {
+      send_triggered_update(r, router.updater.flush(router.table, now_));
+    } else if (!router.updater.pending_.empty()
+        && router.triggered_at != router.updater.hold_down_end_) {
+      router.triggered_at = router.updater.hold_down_end_;
+      schedule(router.triggered_at, EventKind::kTriggered, r, 0, kNoPayload);
+    }
+  }
+
+  void deliver(uint32_t r, uint32_t p, uint32_t payload) {
+    auto &router = *routers_[r];
+    const uint8_t *datagram = payloads_[payload].data();
+    if (router.ports[p].up) {
+      ip::HeaderReader ip_reader{datagram};
+      auto reader = rip::PacketHeaderReader::from_ip_header_reader(ip_reader);
+      RipPacketView view{reader, p, ip_reader.read_source_address()};
+      if (view.is_valid() && view.is_response()) {
+        changed_.clear();
+        InputProcessor{&router.table, &router.ager,
+          &router.damper, now_}.process_response(view, changed_);
+        commit(r, changed_, {});
+      }
+    }
+    free_payloads_.push_back(payload);
+  }
+
+  void send_regular_update(uint32_t r) {
+    auto &router = *routers_[r];
+    for (const auto &response : router.responses) {
+      for (size_t i=0; i<response.datagram_num(); ++i) {
+        send(r, response.interface_index_,
+          response.datagram(i), response.datagram_length(i));
+      }
+    }
+    router.updater.on_regular_update();
+    schedule(now_ + kRegularResponsePeriod - kRegularResponseJitter
+      + random_() % (2 * kRegularResponseJitter + 1),
+      EventKind::kRegular, r, 0, kNoPayload);
+  }
+
+  // Takes down a link as both ends would notice it: the link subnet and
+  // every route through it are withdrawn.
+  void fail_link(uint32_t link) {
+    for (auto r : {links_[link].first, links_[link].second}) {
+      auto &router = *routers_[r];
+      std::vector<RoutingTable::Entry> changed;
+      for (uint32_t p=0; p<router.ports.size(); ++p) {
+        if (router.ports[p].link != link) {
+          continue;
+        }
+        router.ports[p].up = false;
+        for (uint32_t i=0; i<router.table.size(); ++i) {
+          auto e = router.table.entry(i);
+          if (e.interface_index == p && e.metric < kInfinityMetric) {
+            e.metric = kInfinityMetric;
+            router.table.add(e);
+            router.ager.withdraw(e.prefix, now_);
+            changed.push_back(e);
+          }
+        }
+      }
+      commit(r, changed, {});
+    }
+  }
+
+  void process(const Event &event) {
+    now_ = event.time;
+    uint32_t r = event.router;
+    auto &router = *routers_[r];
+    auto start = std::chrono::steady_clock::now();
+    std::vector<RoutingTable::Entry> expired;
+    std::vector<Ipv4Prefix> removed;
+    router.ager.advance(now_, expired, removed);
+    commit(r, expired, removed);
+    switch (event.kind) {
+      case EventKind::kRegular:
+        send_regular_update(r);
+        break;
+      case EventKind::kTriggered:
+        router.triggered_at = kNoEvent;
+        flush_triggered_update(r);
+        break;
+      case EventKind::kDelivery:
+        deliver(r, event.port, event.payload);
+        break;
+      case EventKind::kFailure:
+        fail_link(event.port);
+        break;
+    }
+    router.cpu_time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  }
+
+  // Runs until no route changed for `kQuietPeriod` after `not_before`.
+  // Returns false if the horizon was reached first.
+  bool run_until_quiet(uint64_t not_before) {
+    while (!events_.empty()) {
+      Event event = events_.top();
+      if (event.time > std::max(last_change_, not_before) + kQuietPeriod) {
+        return true;
+      }
+      if (event.time > kHorizon) {
+        return false;
+      }
+      events_.pop();
+      process(event);
+    }
+    return true;
+  }
+
+  // Hop counts from router `source`, over links that are up.
+  std::vector<uint32_t> distances_from(uint32_t source) const {
+    std::vector<uint32_t> distances(routers_.size(), kInfinityMetric);
+    std::vector<uint32_t> queue = {source};
+    distances[source] = 0;
+    for (size_t head=0; head<queue.size(); ++head) {
+      uint32_t r = queue[head];
+      for (const auto &port : routers_[r]->ports) {
+        if (port.up && distances[port.peer] == kInfinityMetric) {
+          distances[port.peer] = distances[r] + 1;
+          queue.push_back(port.peer);
+        }
+      }
+    }
+    return distances;
+  }
+
+  // Checks every stub route of every router against shortest paths.
+  size_t count_wrong_routes() const {
+    size_t wrong = 0;
+    for (uint32_t origin=0; origin<routers_.size(); ++origin) {
+      auto distances = distances_from(origin);
+      for (uint32_t r=0; r<routers_.size(); ++r) {
+        uint32_t expected = std::min(distances[r] + 1, kInfinityMetric);
+        for (uint32_t k=0; k<stub_num(); ++k) {
+          RoutingTable::Entry found;
+          uint32_t metric = routers_[r]->table.find(
+            stub_prefix(origin * stub_num() + k), found)
+            ? found.metric : kInfinityMetric;
+          wrong += metric != expected;
+        }
+      }
+    }
+    return wrong;
+  }
+
+  void report(const char *phase, uint64_t since, bool converged) {
+    uint64_t message_num = 0, byte_num = 0, cpu_time = 0, max_cpu_time = 0;
+    uint32_t busiest = 0;
+    for (uint32_t r=0; r<routers_.size(); ++r) {
+      const auto &router = *routers_[r];
+      message_num += router.message_num;
+      byte_num += router.byte_num;
+      cpu_time += router.cpu_time;
+      if (router.cpu_time > max_cpu_time) {
+        max_cpu_time = router.cpu_time;
+        busiest = r;
+      }
+    }
+    fmt::print("{}: {} after {:.3f} s of virtual time, {} wrong routes\n",
+      phase, converged ? "converged" : "NOT converged",
+      (last_change_ - std::min(last_change_, since)) / 1000.0,
+      count_wrong_routes());
+    fmt::print("  {} messages, {} bytes\n", message_num, byte_num);
+    fmt::print("  CPU time: {:.3f} ms in total, {:.3f} ms per router, "
+      "{:.3f} ms at most (router {})\n", cpu_time / 1e6,
+      cpu_time / 1e6 / routers_.size(), max_cpu_time / 1e6, busiest);
+  }
+
+  void reset_counters() {
+    for (auto &router : routers_) {
+      router->message_num = router->byte_num = router->cpu_time = 0;
+    }
+  }
+};
+
+bool parse_options(int argc, char **argv, Options &options) {
+  if (argc < 4) {
+    return false;
+  }
+  options.topology = argv[1];
+  options.router_num = std::strtoul(argv[2], nullptr, 10);
+  options.route_num = std::strtoul(argv[3], nullptr, 10);
+  for (int i=4; i<argc; ++i) {
+    if (std::strcmp(argv[i], "--poison") == 0) {
+      options.poisoned_reverse = true;
+    } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      options.seed = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--fail-at") == 0 && i + 1 < argc) {
+      options.fail_at = std::strtoull(argv[++i], nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return options.router_num >= 2
+    && options.route_num >= options.router_num;
+}
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    fmt::print(stderr, "usage: {} chain|ring|grid|random ROUTERS ROUTES "
+      "[--seed N] [--fail-at MS] [--poison]\n", argv[0]);
+    return 2;
+  }
+  Network network{options};
+  if (!network.build_topology()) {
+    fmt::print(stderr, "unknown topology: {}\n", options.topology);
+    return 2;
+  }
+  network.configure_routers();
+  fmt::print("{} routers, {} links, {} stub routes each, split horizon{}\n",
+    options.router_num, network.links_.size(), network.stub_num(),
+    options.poisoned_reverse ? " with poisoned reverse" : "");
+  bool converged = network.run_until_quiet(0);
+  network.report("Cold start", 0, converged);
+  if (options.fail_at != kNoEvent) {
+    uint64_t fail_at = std::max(options.fail_at, network.now_);
+    uint32_t link = network.random_() % network.links_.size();
+    fmt::print("Failing link {} ({} - {}) at {:.3f} s\n", link,
+      network.links_[link].first, network.links_[link].second,
+      fail_at / 1000.0);
+    network.reset_counters();
+    network.last_change_ = fail_at;
+    network.schedule(fail_at, EventKind::kFailure,
+      network.links_[link].first, link, kNoPayload);
+    converged = network.run_until_quiet(fail_at);
+    network.report("Link failure", fail_at, converged);
+  }
+  return 0;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "format/common.hpp"
+#include "timer.hpp"
 
 
 namespace ripv2 {
@@ -19,6 +20,10 @@ struct Ipv4Prefix {
     return { address & mask, mask };
   }
 
+  uint32_t mask_length() const {
+    return 32 - quick_log2(-mask_.data_);
+  }
+
   bool operator==(const Ipv4Prefix &other) const {
     return this->address_ == other.address_ && this->mask_ == other.mask_;
   }
@@ -28,6 +33,22 @@ struct Ipv4Prefix {
   }
 };
 
+constexpr uint32_t kInfinityMetric = 16;
+constexpr uint32_t kNotFound = -1;
+constexpr size_t kMaxNextHopNum = 65536;
+  // ^ Next hop ids are 16-bit.
+
+// The RIB: every route learned or configured, including unreachable ones.
+// Forwarding never reads it directly; see `fib::Fib`.
+//
+// Routes are stored struct-of-arrays in 8 bytes each (address, prefix
+// length, metric and an index into the interned, reference-counted
+// `next_hops_`), plus the id of the route's timeout or garbage-collection
+// timer and whether it is a stale route restored from a checkpoint, and
+// located by exact prefix through `slots_`, an open-addressing (linear
+// probing) hash of positions in those arrays. Deletion shifts the following
+// cluster back instead of leaving tombstones, so probe lengths never
+// degrade under churn.
 struct RoutingTable {
 
   struct Entry {
@@ -37,42 +58,181 @@ struct RoutingTable {
     Ipv4Address next_hop;
   };
 
-  std::vector<Entry> entries_;
+  struct NextHop {
+    uint32_t interface_index;
+    Ipv4Address address;
+  };
 
-  void add(Entry entry) {
-    for (auto &e : entries_) {
-      if (e.prefix == entry.prefix) {
-        e = entry;
-        return;
-      }
+  std::vector<uint32_t> addresses_;
+  std::vector<uint8_t> lengths_;
+  std::vector<uint8_t> metrics_;
+  std::vector<uint16_t> next_hop_ids_;
+  std::vector<uint32_t> timers_;
+  std::vector<uint8_t> stale_;
+  std::vector<NextHop> next_hops_;
+  std::vector<uint32_t> next_hop_refs_;
+  std::vector<uint16_t> free_next_hops_;
+  std::vector<uint32_t> slots_ = std::vector<uint32_t>(16, kNotFound);
+
+  size_t size() const {
+    return addresses_.size();
+  }
+
+  Ipv4Prefix prefix(uint32_t index) const {
+    return { { addresses_[index] },
+      Ipv4Address::mask_from_length(lengths_[index]) };
+  }
+
+  Entry entry(uint32_t index) const {
+    const auto &next_hop = next_hops_[next_hop_ids_[index]];
+    return { prefix(index), metrics_[index],
+      next_hop.interface_index, next_hop.address };
+  }
+
+  std::vector<Entry> entries() const {
+    std::vector<Entry> result;
+    result.reserve(size());
+    for (uint32_t i=0; i<size(); ++i) {
+      result.push_back(entry(i));
+    }
+    return result;
+  }
+
+  uint32_t index_of(Ipv4Prefix prefix) const {
+    return slots_[locate(prefix.address_.data_, prefix.mask_length())];
+  }
+
+  bool find(Ipv4Prefix prefix, Entry &entry) const {
+    uint32_t index = index_of(prefix);
+    if (index == kNotFound) {
+      return false;
+    }
+    entry = this->entry(index);
+    return true;
+  }
+
+  // Returns false, leaving the table as it is, when the route needs a new
+  // next hop while all `kMaxNextHopNum` are in use.
+  bool add(Entry entry) {
+    uint32_t length = entry.prefix.mask_length();
+    uint32_t next_hop_id = intern_next_hop(
+      entry.interface_index, entry.next_hop);
+    if (next_hop_id == kNotFound) {
+      return false;
+    }
+    ++next_hop_refs_[next_hop_id];
+    size_t slot = locate(entry.prefix.address_.data_, length);
+    uint32_t index = slots_[slot];
+    if (index != kNotFound) {
+      release_next_hop(next_hop_ids_[index]);
+      metrics_[index] = entry.metric;
+      next_hop_ids_[index] = next_hop_id;
+      stale_[index] = false;
+      return true;
     }
-    entries_.push_back(entry);
+    if (2 * (size() + 1) > slots_.size()) {
+      rehash(2 * slots_.size());
+      slot = locate(entry.prefix.address_.data_, length);
+    }
+    slots_[slot] = size();
+    addresses_.push_back(entry.prefix.address_.data_);
+    lengths_.push_back(length);
+    metrics_.push_back(entry.metric);
+    next_hop_ids_.push_back(next_hop_id);
+    timers_.push_back(timer::kNoTimer);
+    stale_.push_back(false);
+    return true;
   }
 
   void remove(Ipv4Prefix prefix) {
-    for (auto it=entries_.cbegin(); it!=entries_.cend(); ++it) {
-      if (it->prefix == prefix) {
-        entries_.erase(it);
-        return;
+    size_t hole = locate(prefix.address_.data_, prefix.mask_length());
+    uint32_t index = slots_[hole];
+    if (index == kNotFound) {
+      return;
+    }
+    release_next_hop(next_hop_ids_[index]);
+    size_t mask = slots_.size() - 1;
+    for (size_t i=(hole+1)&mask; slots_[i]!=kNotFound; i=(i+1)&mask) {
+      size_t home = home_of(addresses_[slots_[i]], lengths_[slots_[i]]);
+      if (((i - home) & mask) >= ((i - hole) & mask)) {
+        slots_[hole] = slots_[i];
+        hole = i;
       }
     }
+    slots_[hole] = kNotFound;
+    uint32_t last = size() - 1;
+    if (index != last) {
+      slots_[locate(addresses_[last], lengths_[last])] = index;
+      addresses_[index] = addresses_[last];
+      lengths_[index] = lengths_[last];
+      metrics_[index] = metrics_[last];
+      next_hop_ids_[index] = next_hop_ids_[last];
+      timers_[index] = timers_[last];
+      stale_[index] = stale_[last];
+    }
+    addresses_.pop_back();
+    lengths_.pop_back();
+    metrics_.pop_back();
+    next_hop_ids_.pop_back();
+    timers_.pop_back();
+    stale_.pop_back();
+  }
+
+  size_t home_of(uint32_t address, uint32_t length) const {
+    uint64_t key = static_cast<uint64_t>(address) << 32 | length;
+    return (key * 0x9e3779b97f4a7c15) >> (64 - quick_log2(slots_.size()));
+  }
+
+  size_t locate(uint32_t address, uint32_t length) const {
+    size_t mask = slots_.size() - 1;
+    size_t i = home_of(address, length);
+    while (slots_[i] != kNotFound && (addresses_[slots_[i]] != address
+        || lengths_[slots_[i]] != length)) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  void rehash(size_t capacity) {
+    std::vector<uint32_t>(capacity, kNotFound).swap(slots_);
+    for (uint32_t i=0; i<size(); ++i) {
+      slots_[locate(addresses_[i], lengths_[i])] = i;
+    }
   }
 
-  bool query(Ipv4Address address, uint32_t &interface_index,
-      Ipv4Address &next_hop) const {
-    const RoutingTable::Entry *found = nullptr;
-    for (const auto &e : entries_) {
-      if (e.prefix.matched_by(address) && (!found
-          || e.prefix.mask_.data_ > found->prefix.mask_.data_)) {
-        found = &e;
+  // Next hops are reference counted by the routes using them; the caller
+  // takes the reference. Returns `kNotFound` when all ids are in use.
+  uint32_t intern_next_hop(uint32_t interface_index, Ipv4Address address) {
+    for (size_t i=next_hops_.size(); i>0; --i) {
+      // ^ Recently added next hops are the likeliest to be seen again.
+      const auto &next_hop = next_hops_[i-1];
+      if (next_hop.interface_index == interface_index
+          && next_hop.address == address) {
+        return i - 1;
       }
     }
-    if (!found) {
-      return false;
+    uint32_t id;
+    if (!free_next_hops_.empty()) {
+      id = free_next_hops_.back();
+      free_next_hops_.pop_back();
+    } else if (next_hops_.size() < kMaxNextHopNum) {
+      id = next_hops_.size();
+      next_hops_.emplace_back();
+      next_hop_refs_.push_back(0);
+    } else {
+      return kNotFound;
+    }
+    next_hops_[id] = {interface_index, address};
+    return id;
+  }
+
+  // A next hop no route uses any more is cleared, so that it matches no
+  // lookup, and its id reused.
+  void release_next_hop(uint32_t id) {
+    if (--next_hop_refs_[id] == 0) {
+      next_hops_[id] = {kNotFound, {0}};
+      free_next_hops_.push_back(id);
     }
-    interface_index = found->interface_index;
-    next_hop = found->next_hop;
-    return true;
   }
 };
 }
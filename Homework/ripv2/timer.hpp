@@ -0,0 +1,162 @@
+#pragma once
+
+#include "common.hpp"
+
+
+namespace ripv2 {
+
+namespace timer {
+
+constexpr uint32_t kNoTimer = -1;
+
+// Hierarchical timing wheel: level L has 64 slots of 64^L ticks each, and
+// a timer sits in the lowest level whose span covers its remaining delay.
+// Whenever the level-0 wheel wraps, the due slot of the next level is
+// cascaded down. Scheduling, rescheduling and cancelling are O(1), and so
+// is each expiry up to the bounded number of cascades. Delays must stay
+// below 64^4 ticks. The clock reads 0 until `start` sets it.
+struct TimingWheel {
+
+  static constexpr uint32_t kLevelNum = 4;
+  static constexpr uint32_t kSlotBits = 6;
+  static constexpr uint32_t kSlotNum = 1 << kSlotBits;
+
+  struct Timer {
+    uint32_t prev, next;
+    uint64_t expiry;
+    uint64_t payload;
+    uint32_t level, slot;
+      // ^ `level` is kLevelNum while the timer is idle.
+  };
+
+  using Heads = std::array<std::array<uint32_t, kSlotNum>, kLevelNum>;
+
+  uint64_t tick_length_;
+  uint64_t current_tick_ = 0;
+  std::vector<Timer> timers_;
+  std::vector<uint32_t> free_timers_;
+  Heads heads_ = filled_heads();
+
+  explicit TimingWheel(uint64_t tick_length) : tick_length_(tick_length) {}
+
+  static Heads filled_heads() {
+    Heads heads;
+    for (auto &level : heads) {
+      level.fill(kNoTimer);
+    }
+    return heads;
+  }
+
+  bool is_active(uint32_t id) const {
+    return timers_[id].level != kLevelNum;
+  }
+
+  uint64_t payload_of(uint32_t id) const {
+    return timers_[id].payload;
+  }
+
+  // Sets the clock to `now` while no timer is scheduled. Clocks counting
+  // from boot would otherwise have `advance` walk every tick since then.
+  void start(uint64_t now) {
+    current_tick_ = now / tick_length_;
+  }
+
+  // Returns a timer id that stays valid until `release`.
+  uint32_t schedule(uint64_t now, uint64_t delay, uint64_t payload) {
+    uint32_t id;
+    if (!free_timers_.empty()) {
+      id = free_timers_.back();
+      free_timers_.pop_back();
+    } else {
+      id = timers_.size();
+      timers_.push_back({});
+    }
+    timers_[id].level = kLevelNum;
+    timers_[id].payload = payload;
+    reschedule(id, now, delay);
+    return id;
+  }
+
+  void reschedule(uint32_t id, uint64_t now, uint64_t delay) {
+    cancel(id);
+    timers_[id].expiry = (now + delay + tick_length_ - 1) / tick_length_;
+    link(id, current_tick_ + 1);
+  }
+
+  void cancel(uint32_t id) {
+    if (is_active(id)) {
+      unlink(id);
+    }
+  }
+
+  void release(uint32_t id) {
+    cancel(id);
+    free_timers_.push_back(id);
+  }
+
+  // Fires `on_expiry(id)` for every timer due by `now`, tick by tick. The
+  // callback may reschedule or release the timer.
+  template<typename F> void advance(uint64_t now, F on_expiry) {
+    uint64_t target = now / tick_length_;
+    while (current_tick_ < target) {
+      ++current_tick_;
+      for (uint32_t level=1; level<kLevelNum; ++level) {
+        if (current_tick_ % (static_cast<uint64_t>(1)
+            << (kSlotBits * level)) != 0) {
+          break;
+        }
+        uint32_t slot = (current_tick_ >> (kSlotBits * level)) % kSlotNum;
+        uint32_t id = heads_[level][slot];
+        heads_[level][slot] = kNoTimer;
+        while (id != kNoTimer) {
+          uint32_t next = timers_[id].next;
+          timers_[id].level = kLevelNum;
+          link(id, current_tick_);
+          id = next;
+        }
+      }
+      auto &head = heads_[0][current_tick_ % kSlotNum];
+      while (head != kNoTimer) {
+        uint32_t id = head;
+        unlink(id);
+        on_expiry(id);
+      }
+    }
+  }
+
+  // The slot of the current tick is only still pending while cascading, so
+  // other callers pass `current_tick_ + 1` as the earliest expiry.
+  void link(uint32_t id, uint64_t earliest) {
+    auto &timer = timers_[id];
+    timer.expiry = std::max(timer.expiry, earliest);
+    uint64_t delay = timer.expiry - current_tick_;
+    uint32_t level = 0;
+    while (level + 1 < kLevelNum && delay >= (static_cast<uint64_t>(1)
+        << (kSlotBits * (level + 1)))) {
+      ++level;
+    }
+    timer.level = level;
+    timer.slot = (timer.expiry >> (kSlotBits * level)) % kSlotNum;
+    timer.prev = kNoTimer;
+    timer.next = heads_[level][timer.slot];
+    if (timer.next != kNoTimer) {
+      timers_[timer.next].prev = id;
+    }
+    heads_[level][timer.slot] = id;
+  }
+
+  void unlink(uint32_t id) {
+    auto &timer = timers_[id];
+    if (timer.prev != kNoTimer) {
+      timers_[timer.prev].next = timer.next;
+    } else {
+      heads_[timer.level][timer.slot] = timer.next;
+    }
+    if (timer.next != kNoTimer) {
+      timers_[timer.next].prev = timer.prev;
+    }
+    timer.level = kLevelNum;
+  }
+};
+}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <random>
+
+#include "table.hpp"
+
+
+namespace ripv2 {
+
+namespace triggering {
+
+using namespace format;
+
+// RFC 2453 §3.10.1 triggered updates: the first change is sent at once,
+// after which a random 1-5 s hold-down starts; changes arriving meanwhile
+// are accumulated and sent together when it ends, and dropped when a
+// regular update goes out first. A prefix changed several times is sent
+// once, with its state at flush time.
+struct TriggeredUpdater {
+
+  static constexpr uint64_t kMinHoldDown = 1000;
+  static constexpr uint64_t kMaxHoldDown = 5000;
+
+  std::mt19937 random_;
+  std::vector<table::Ipv4Prefix> pending_;
+  uint64_t pending_trigger_num_ = 0;
+  uint64_t hold_down_end_ = 0;
+  uint64_t sent_ = 0;
+  uint64_t suppressed_ = 0;
+    // ^ Triggers merged into another triggered or regular update.
+
+  explicit TriggeredUpdater(uint32_t seed) : random_(seed) {}
+
+  void note(const std::vector<table::RoutingTable::Entry> &changed) {
+    if (changed.empty()) {
+      return;
+    }
+    for (const auto &e : changed) {
+      pending_.push_back(e.prefix);
+    }
+    ++pending_trigger_num_;
+  }
+
+  bool is_due(uint64_t now) const {
+    return !pending_.empty() && now >= hold_down_end_;
+  }
+
+  // Returns the current entries of the pending routes (routes deleted in
+  // the meantime are skipped) and starts the next hold-down.
+  std::vector<table::RoutingTable::Entry> flush(
+      const table::RoutingTable &table, uint64_t now) {
+    std::sort(pending_.begin(), pending_.end(),
+      [](table::Ipv4Prefix a, table::Ipv4Prefix b) {
+        return a.address_.data_ != b.address_.data_
+          ? a.address_.data_ < b.address_.data_
+          : a.mask_.data_ < b.mask_.data_;
+      });
+    pending_.erase(std::unique(pending_.begin(), pending_.end()),
+      pending_.end());
+    std::vector<table::RoutingTable::Entry> entries;
+    entries.reserve(pending_.size());
+    for (auto prefix : pending_) {
+      uint32_t index = table.index_of(prefix);
+      if (index != table::kNotFound) {
+        entries.push_back(table.entry(index));
+      }
+    }
+    ++sent_;
+    suppressed_ += pending_trigger_num_ - 1;
+    clear();
+    hold_down_end_ = now + std::uniform_int_distribution<uint64_t>(
+      kMinHoldDown, kMaxHoldDown)(random_);
+    return entries;
+  }
+
+  // A regular update carries every pending change already.
+  void on_regular_update() {
+    suppressed_ += pending_trigger_num_;
+    clear();
+  }
+
+  void clear() {
+    pending_.clear();
+    pending_trigger_num_ = 0;
+  }
+};
+}
+}